@@ -0,0 +1,13 @@
+#!/bin/sh
+# Time every benchmark with each interpreter given as an argument
+# Usage: bench/run.sh build/mlisp build/mlisp_switch
+
+cd "$(dirname "$0")/.."
+for bench in bench/*.mlisp; do
+  for mlisp in "$@"; do
+    start=$(date +%s.%N)
+    "$mlisp" "$bench" > /dev/null
+    end=$(date +%s.%N)
+    printf '%-24s %-22s %.3fs\n' "$bench" "$mlisp" "$(awk "BEGIN { print $end - $start }")"
+  done
+done
@@ -0,0 +1,21 @@
+#!/bin/sh
+# Time starting each interpreter given as an argument many times on a short
+# script, with the stdlib defined eagerly and lazily
+# Usage: bench/startup.sh build/mlisp build/mlisp_switch
+
+cd "$(dirname "$0")/.."
+script=bench/startup.mlisp
+runs=200
+for mlisp in "$@"; do
+  for mode in "" --lazy-stdlib; do
+    start=$(date +%s.%N)
+    i=0
+    while [ $i -lt $runs ]; do
+      "$mlisp" $mode "$script" > /dev/null
+      i=$((i + 1))
+    done
+    end=$(date +%s.%N)
+    printf '%-22s %-14s %.2fms\n' "$mlisp" "${mode:-eager}" \
+      "$(awk "BEGIN { print ($end - $start) * 1000 / $runs }")"
+  done
+done
@@ -1,6 +1,25 @@
+/* Heap images are mapped into memory where mmap exists, see limg_map */
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#define _DEFAULT_SOURCE
+#define LMMAP 1
+#endif
+
+/* The baseline JIT maps executable pages, see ljit_compile */
+#if LMMAP && defined(LVM_JIT) && defined(__x86_64__) && defined(__linux__)
+#define LJIT 1
+#endif
+
 #include "mpc.h"
+#include <limits.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#if LMMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #ifdef __EMSCRIPTEN__
 
@@ -44,17 +63,59 @@ void add_history(char *unused) {}
   LASSERT(a, a->cell[i]->type == tp,                                           \
           "Function '%s' passed incorrect type. Got %s, Expected %s.", func,   \
           ltype_name(a->cell[i]->type), ltype_name(tp))
+#define LASSERT_INDEX(func, a, v, i)                                           \
+  LASSERT(a, i >= 0 && i < v->count,                                           \
+          "Function '%s' passed index %li out of range for length %i.", func,  \
+          i, v->count)
 
 /* Forward Declarations */
 struct lval;
 struct lenv;
+struct lcode;
+struct lnode;
+struct lvec;
+struct lseq;
+struct lmemo;
+struct lpartial;
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct lcode lcode;
+typedef struct lnode lnode;
+typedef struct lvec lvec;
+typedef struct lseq lseq;
+typedef struct lmemo lmemo;
+typedef struct lpartial lpartial;
 char *lval_to_str(lval *v);
 void lval_print(lval *v);
 lval *lval_eval(lenv *e, lval *v);
+void lval_del(lval *v);
+lval *lval_guard(void);
+int lstack_full(void);
+lval *lval_call(lenv *e, lval *f, lval *a);
+lval *lmemo_call(lenv *e, lmemo *m, lval *a);
+void lmemo_release(lmemo *m);
+lval *lpartial_call(lenv *e, lval *f, lval *a);
+lval *lpartial_root(lval *f, int *given);
+int lval_arity(lval *f, int *rest);
+void lpartial_release(lpartial *p);
 void lenv_del(lenv *e);
 lenv *lenv_copy(lenv *e);
+void lenv_add_builtins(lenv *e);
+lcode *lcode_compile(lval *formals, lval *body);
+lcode *lcode_retain(lcode *c);
+void lcode_release(lcode *c);
+lval *lvm_run(lenv *e, lcode *c);
+lval *lkern_call(lenv *e, lval *f, lval **args, int n);
+int lvm_binop(lval *f, long x, long y, long *r);
+lnode *lnode_compile(lval *formals, lval *body);
+lnode *lnode_retain(lnode *n);
+void lnode_release(lnode *n);
+lval *lnode_enter(lval *f);
+void lfold_print(lval *x);
+int lpipe_stages(lval *x);
+lval *lpipe_stage(lval *x, int s);
+lval *lpipe_call(lenv *e, lval *form, lval **items);
+int lstub_force(lenv *e, char *sym);
 mpc_parser_t *Number;
 mpc_parser_t *Symbol;
 mpc_parser_t *String;
@@ -65,6 +126,60 @@ mpc_parser_t *Expr;
 mpc_parser_t *Mlisp;
 int mlisp_init();
 lenv *globalEnv;
+/* How lambda bodies are evaluated: by the tree-walker, compiled to bytecode
+ * or compiled to a tree of closures */
+enum { LENGINE_WALK, LENGINE_VM, LENGINE_CLOSURE };
+int lengine = LENGINE_VM;
+
+/* Whether no pure builtin has been rebound, so calls of them folded at
+ * compile time are still valid, and whether to print folded forms */
+int lfold_intact = 1;
+int lfold_dump = 0;
+
+/* Whether no special form compiled inline has been rebound, so the code
+ * compiled for it still does what evaluating the form does */
+int lform_intact = 1;
+
+/* Whether chains of 'map', 'filter' and 'foldl' make a single pass, and
+ * how many calls and their elements are fused at most. Only chains of pure
+ * functions are, seen through at most LPIPE_DEPTH nested lambdas. */
+int lpipe_fuse = 1;
+#define LPIPE_STAGES 8
+#define LPIPE_ITEMS (2 * LPIPE_STAGES + 2)
+#define LPIPE_DEPTH 4
+
+/* Whether compiled lambdas called with Numbers only are run as kernels on
+ * unboxed integers, and after how many such calls */
+int lkern_enabled = 1;
+#define LKERN_CALLS 2
+
+/* Number of calls of a kernel after which it is compiled to native code,
+ * 0 to never compile */
+int ljit_threshold = 1000;
+enum { LKERN_OFF = -1, LKERN_PROFILE, LKERN_ON };
+
+/* Number of lvals allocated and of elements added to expressions, each
+ * growing its array, printed at exit when asked for */
+long lval_allocs = 0;
+long lval_adds = 0;
+int lval_stats = 0;
+
+/* Maximum number of nested calls, and the number currently running */
+int lvm_max_depth = 1000000;
+int lvm_depth = 0;
+
+/* C stack evaluation may use before failing instead of overflowing */
+#ifndef LSTACK_LIMIT
+#if _WIN32 || __EMSCRIPTEN__
+#define LSTACK_LIMIT (512 * 1024)
+#else
+#define LSTACK_LIMIT (6 * 1024 * 1024)
+#endif
+#endif
+char *lstack_top;
+
+/* Set asynchronously to abort the running evaluation */
+volatile sig_atomic_t linterrupted = 0;
 
 /* Enumeration of Possible lval Types */
 enum {
@@ -74,12 +189,115 @@ enum {
   LVAL_STR,
   LVAL_FUN,
   LVAL_SEXPR,
-  LVAL_QEXPR
+  LVAL_QEXPR,
+  LVAL_VEC,
+  LVAL_SEQ,
+  LVAL_FWD
 };
 
 /* Builtin function pointer */
 typedef lval *(*lbuiltin)(lenv *, lval *);
 
+/* Table of builtins: X(opcode, name, function) */
+#define LBUILTINS(X)                                                           \
+  /* List Functions */                                                         \
+  X(LOP_LIST, "list", builtin_list)                                            \
+  X(LOP_HEAD, "head", builtin_head)                                            \
+  X(LOP_TAIL, "tail", builtin_tail)                                            \
+  X(LOP_EVAL, "eval", builtin_eval)                                            \
+  X(LOP_JOIN, "join", builtin_join)                                            \
+                                                                               \
+  /* Mathematical Functions */                                                 \
+  X(LOP_ADD, "+", builtin_add)                                                 \
+  X(LOP_SUB, "-", builtin_sub)                                                 \
+  X(LOP_MUL, "*", builtin_mul)                                                 \
+  X(LOP_DIV, "/", builtin_div)                                                 \
+                                                                               \
+  /* Variable Functions */                                                     \
+  X(LOP_DEF, "def", builtin_def)                                               \
+  X(LOP_PUT, "=", builtin_put)                                                 \
+  X(LOP_LAMBDA, "\\", builtin_lambda)                                          \
+  X(LOP_FUN, "fun", builtin_fun)                                               \
+  X(LOP_SET, "set!", builtin_set)                                              \
+  X(LOP_PARTIAL, "partial", builtin_partial)                                   \
+                                                                               \
+  /* Comparison Functions */                                                   \
+  X(LOP_LT, "<", builtin_lt)                                                   \
+  X(LOP_LTE, "<=", builtin_lte)                                                \
+  X(LOP_GT, ">", builtin_gt)                                                   \
+  X(LOP_GTE, ">=", builtin_gte)                                                \
+  X(LOP_EQ, "==", builtin_eq)                                                  \
+  X(LOP_NE, "!=", builtin_ne)                                                  \
+  X(LOP_AND, "&&", builtin_and)                                                \
+  X(LOP_OR, "||", builtin_or)                                                  \
+  X(LOP_NOT, "!", builtin_not)                                                 \
+  X(LOP_IF, "if", builtin_if)                                                  \
+                                                                               \
+  /* Loop Functions */                                                         \
+  X(LOP_WHILE, "while", builtin_while)                                         \
+  X(LOP_DOTIMES, "dotimes", builtin_dotimes)                                   \
+  X(LOP_FOR_EACH, "for-each", builtin_for_each)                                \
+                                                                               \
+  /* String Functions */                                                       \
+  X(LOP_LOAD, "load", builtin_load)                                            \
+  X(LOP_IMPORT, "import", builtin_import)                                      \
+  X(LOP_EXPORT, "export", builtin_export)                                      \
+  X(LOP_ERROR, "error", builtin_error)                                         \
+  X(LOP_PRINT, "print", builtin_print)                                         \
+                                                                               \
+  /* Vector Functions */                                                       \
+  X(LOP_VECTOR, "vector", builtin_vector)                                      \
+  X(LOP_MAKE_VECTOR, "make-vector", builtin_make_vector)                       \
+  X(LOP_VECTOR_LEN, "vector-len", builtin_vector_len)                          \
+  X(LOP_VECTOR_REF, "vector-ref", builtin_vector_ref)                          \
+  X(LOP_VECTOR_SET, "vector-set!", builtin_vector_set)                         \
+  X(LOP_VECTOR_PUSH, "vector-push!", builtin_vector_push)                      \
+  X(LOP_VECTOR_SLICE, "vector-slice", builtin_vector_slice)                    \
+  X(LOP_VECTOR_TO_LIST, "vector->list", builtin_vector_to_list)                \
+  X(LOP_LIST_TO_VECTOR, "list->vector", builtin_list_to_vector)                \
+                                                                               \
+  /* Sequence Functions */                                                     \
+  X(LOP_SEQ, "seq", builtin_seq)                                               \
+  X(LOP_SEQ_RANGE, "seq-range", builtin_seq_range)                             \
+  X(LOP_SEQ_ITERATE, "seq-iterate", builtin_seq_iterate)                       \
+  X(LOP_SEQ_LINES, "seq-lines", builtin_seq_lines)                             \
+  X(LOP_SEQ_TO_LIST, "seq->list", builtin_seq_to_list)                         \
+                                                                               \
+  /* Memo Functions */                                                         \
+  X(LOP_MEMO, "memo", builtin_memo)                                            \
+  X(LOP_MEMO_STATS, "memo-stats", builtin_memo_stats)                          \
+                                                                               \
+  /* Stdlib Functions */                                                       \
+  X(LOP_LEN, "len", builtin_len)                                               \
+  X(LOP_NTH, "nth", builtin_nth)                                               \
+  X(LOP_LAST, "last", builtin_last)                                            \
+  X(LOP_TAKE, "take", builtin_take)                                            \
+  X(LOP_DROP, "drop", builtin_drop)                                            \
+  X(LOP_ELEM, "elem", builtin_elem)                                            \
+  X(LOP_MAP, "map", builtin_map)                                               \
+  X(LOP_FILTER, "filter", builtin_filter)                                      \
+  X(LOP_FOLDL, "foldl", builtin_foldl)                                         \
+  X(LOP_SUM, "sum", builtin_sum)                                               \
+  X(LOP_PROD, "prod", builtin_prod)
+
+/* Builtin opcodes, one per table entry */
+#define X(op, name, func) op,
+enum { LBUILTINS(X) LOP_COUNT };
+#undef X
+
+/* Forward declare every builtin so the dispatch table can be built */
+#define X(op, name, func) lval *func(lenv *e, lval *a);
+LBUILTINS(X)
+#undef X
+
+/* Name and kernel of a builtin */
+typedef struct {
+  char *name;
+  lbuiltin func;
+} lbuiltin_entry;
+
+lbuiltin_entry lbuiltins[LOP_COUNT];
+
 /* Struct that holds a Lisp value */
 struct lval {
   int type;
@@ -92,18 +310,44 @@ struct lval {
 
   /* Function */
   lbuiltin builtin;
+  int op;
+  /* Results of a function wrapped by 'memo', which is called instead */
+  lmemo *memo;
+  /* Function and arguments of a partial application, called instead */
+  lpartial *partial;
   lenv *env;
   lval *formals;
   lval *body;
+  lcode *code;
+  lnode *node;
 
   /* Expression */
   int count;
   lval **cell;
+
+  /* Vector */
+  lvec *vec;
+
+  /* Sequence */
+  lseq *seq;
+};
+
+/* Storage of a vector, shared by every copy of it so updates are seen
+ * through all of them */
+struct lvec {
+  int refs;
+  int count;
+  int cap;
+  lval **items;
+  /* Last search of lvec_holds to visit it */
+  unsigned mark;
 };
 
 /* Struct that holds an environment */
 struct lenv {
   lenv *par;
+  /* Module namespace that definitions made in this environment belong to */
+  lenv *ns;
   int count;
   char **syms;
   lval **vals;
@@ -125,24 +369,112 @@ char *ltype_name(int t) {
     return "S-Expression";
   case LVAL_QEXPR:
     return "Q-Expression";
+  case LVAL_VEC:
+    return "Vector";
+  case LVAL_SEQ:
+    return "Sequence";
   default:
     return "Unknown";
   }
 }
 
+/* Kinds of lazy sequences */
+enum {
+  LSEQ_LIST,
+  LSEQ_RANGE,
+  LSEQ_ITERATE,
+  LSEQ_LINES,
+  LSEQ_MAP,
+  LSEQ_FILTER,
+  LSEQ_TAKE,
+  LSEQ_DROP
+};
+
+/* A lazy sequence: how to make its elements, which are only made when it
+ * is consumed. Sequences never change, so copies share them. */
+struct lseq {
+  int refs;
+  int kind;
+  /* Function of a map, filter or iterate */
+  lval *f;
+  /* List, first value of an iterate, or path of a file of lines */
+  lval *x;
+  /* Bounds of a range, count of a take or drop */
+  long start;
+  long end;
+  lseq *src;
+};
+
+/* An entry of a memo table, in a bucket and in the order of use */
+typedef struct lmemo_entry {
+  unsigned long hash;
+  lval *key;
+  lval *val;
+  struct lmemo_entry *next;
+  struct lmemo_entry *newer;
+  struct lmemo_entry *older;
+} lmemo_entry;
+
+/* Results of a function by argument list, shared by copies of the
+ * memoized function. With a bound the least recently used are dropped. */
+struct lmemo {
+  int refs;
+  lval *f;
+  long max;
+  long count;
+  long hits;
+  long misses;
+  int cap;
+  lmemo_entry **buckets;
+  lmemo_entry *newest;
+  lmemo_entry *oldest;
+};
+
+/* A function applied to its first arguments, shared by copies of the
+ * partial application. 'fn' is a lambda or another partial application. */
+struct lpartial {
+  int refs;
+  lval *fn;
+  lval *args;
+  /* Arguments still needed before the lambda runs, and whether it takes
+   * any number after them with '&' */
+  int need;
+  int rest;
+};
+
 /* Initializes environment */
 lenv *lenv_new(void) {
   lenv *e = malloc(sizeof(lenv));
   e->par = NULL;
+  e->ns = NULL;
   e->count = 0;
   e->syms = NULL;
   e->vals = NULL;
   return e;
 }
 
+/* Freed lvals are kept for reuse, linked through 'formals', so that
+ * evaluation in a steady state does not call malloc */
+lval *lval_free_list = NULL;
+
+lval *lval_alloc(void) {
+  lval_allocs++;
+  lval *v = lval_free_list;
+  if (v) {
+    lval_free_list = v->formals;
+    return v;
+  }
+  return malloc(sizeof(lval));
+}
+
+void lval_free(lval *v) {
+  v->formals = lval_free_list;
+  lval_free_list = v;
+}
+
 /* Construct a pointer to a new Number lval */
 lval *lval_num(long x) {
-  lval *v = malloc(sizeof(lval));
+  lval *v = lval_alloc();
   v->type = LVAL_NUM;
   v->num = x;
   return v;
@@ -150,7 +482,7 @@ lval *lval_num(long x) {
 
 /* Construct a pointer to a new Error lval */
 lval *lval_err(char *fmt, ...) {
-  lval *v = malloc(sizeof(lval));
+  lval *v = lval_alloc();
   v->type = LVAL_ERR;
 
   /* Create a va list and initialize it */
@@ -174,7 +506,7 @@ lval *lval_err(char *fmt, ...) {
 
 /* Construct a pointer to a new Symbol lval */
 lval *lval_sym(char *s) {
-  lval *v = malloc(sizeof(lval));
+  lval *v = lval_alloc();
   v->type = LVAL_SYM;
   v->sym = malloc(strlen(s) + 1);
   strcpy(v->sym, s);
@@ -183,7 +515,7 @@ lval *lval_sym(char *s) {
 
 /* A pointer to a new empty Sexpr lval */
 lval *lval_sexpr(void) {
-  lval *v = malloc(sizeof(lval));
+  lval *v = lval_alloc();
   v->type = LVAL_SEXPR;
   v->count = 0;
   v->cell = NULL;
@@ -192,7 +524,7 @@ lval *lval_sexpr(void) {
 
 /* A pointer to a new empty Qexpr lval */
 lval *lval_qexpr(void) {
-  lval *v = malloc(sizeof(lval));
+  lval *v = lval_alloc();
   v->type = LVAL_QEXPR;
   v->count = 0;
   v->cell = NULL;
@@ -201,27 +533,169 @@ lval *lval_qexpr(void) {
 
 /* A pointer to a new empty String lval */
 lval *lval_str(char *s) {
-  lval *v = malloc(sizeof(lval));
+  lval *v = lval_alloc();
   v->type = LVAL_STR;
   v->str = malloc(strlen(s) + 1);
   strcpy(v->str, s);
   return v;
 }
 
-/* A pointer to a new empty Function lval */
-lval *lval_fun(lbuiltin func) {
-  lval *v = malloc(sizeof(lval));
+/* A pointer to a new builtin Function lval for opcode 'op' */
+lval *lval_fun(int op) {
+  lval *v = lval_alloc();
   v->type = LVAL_FUN;
-  v->builtin = func;
+  v->builtin = lbuiltins[op].func;
+  v->op = op;
+  v->memo = NULL;
+  v->partial = NULL;
+  return v;
+}
+
+/* A new empty vector with room for 'cap' items, or NULL when there is no
+ * memory for them */
+lvec *lvec_new(int cap) {
+  lvec *v = malloc(sizeof(lvec));
+  v->refs = 1;
+  v->count = 0;
+  v->cap = cap;
+  v->items = malloc(sizeof(lval *) * cap);
+  v->mark = 0;
+  if (cap && !v->items) {
+    free(v);
+    return NULL;
+  }
+  return v;
+}
+
+/* Append 'x', which is taken, doubling the storage when it is full */
+void lvec_push(lvec *v, lval *x) {
+  if (v->count == v->cap) {
+    v->cap = v->cap > INT_MAX / 2 ? INT_MAX : v->cap ? v->cap * 2 : 4;
+    v->items = realloc(v->items, sizeof(lval *) * v->cap);
+  }
+  v->items[v->count++] = x;
+}
+
+/* Whether 'x' is the vector 'v' or holds it somewhere inside. Storing such
+ * a value in 'v' would make it contain itself. Each search marks the
+ * vectors it visited, so shared ones are only looked through once. */
+unsigned lvec_search;
+
+int lvec_holds_step(lval *x, lvec *v) {
+  switch (x->type) {
+  case LVAL_VEC:
+    if (x->vec == v) {
+      return 1;
+    }
+    if (x->vec->mark == lvec_search) {
+      return 0;
+    }
+    x->vec->mark = lvec_search;
+    for (int i = 0; i < x->vec->count; i++) {
+      if (lvec_holds_step(x->vec->items[i], v)) {
+        return 1;
+      }
+    }
+    return 0;
+  case LVAL_SEXPR:
+  case LVAL_QEXPR:
+    for (int i = 0; i < x->count; i++) {
+      if (lvec_holds_step(x->cell[i], v)) {
+        return 1;
+      }
+    }
+    return 0;
+  case LVAL_FUN:
+    if (x->partial) {
+      return lvec_holds_step(x->partial->fn, v) ||
+             lvec_holds_step(x->partial->args, v);
+    }
+    return !x->builtin && (lvec_holds_step(x->formals, v) ||
+                           lvec_holds_step(x->body, v));
+  }
+  return 0;
+}
+
+int lvec_holds(lval *x, lvec *v) {
+  lvec_search++;
+  return lvec_holds_step(x, v);
+}
+
+void lvec_release(lvec *v) {
+  if (--v->refs > 0) {
+    return;
+  }
+  for (int i = 0; i < v->count; i++) {
+    lval_del(v->items[i]);
+  }
+  free(v->items);
+  free(v);
+}
+
+lseq *lseq_new(int kind, lval *f, lval *x, lseq *src) {
+  lseq *s = malloc(sizeof(lseq));
+  s->refs = 1;
+  s->kind = kind;
+  s->f = f;
+  s->x = x;
+  s->start = 0;
+  s->end = 0;
+  s->src = src;
+  if (src) {
+    src->refs++;
+  }
+  return s;
+}
+
+void lseq_release(lseq *s) {
+  while (s && --s->refs == 0) {
+    lseq *src = s->src;
+    if (s->f) {
+      lval_del(s->f);
+    }
+    if (s->x) {
+      lval_del(s->x);
+    }
+    free(s);
+    s = src;
+  }
+}
+
+/* A pointer to a new Sequence lval holding 'seq', which is taken */
+lval *lval_seq(lseq *seq) {
+  lval *v = lval_alloc();
+  v->type = LVAL_SEQ;
+  v->seq = seq;
+  return v;
+}
+
+/* A binding imported into a namespace, which lookups follow to the same
+ * symbol in module namespace 'ns', see lenv_follow. 'num' is the slot it
+ * was last found at. */
+lval *lval_fwd(lenv *ns) {
+  lval *v = lval_alloc();
+  v->type = LVAL_FWD;
+  v->env = ns;
+  v->num = 0;
+  return v;
+}
+
+/* A pointer to a new Vector lval holding 'vec', which is taken */
+lval *lval_vec(lvec *vec) {
+  lval *v = lval_alloc();
+  v->type = LVAL_VEC;
+  v->vec = vec;
   return v;
 }
 
 lval *lval_lambda(lval *formals, lval *body) {
-  lval *v = malloc(sizeof(lval));
+  lval *v = lval_alloc();
   v->type = LVAL_FUN;
 
   /* Set Builtin to Null */
   v->builtin = NULL;
+  v->memo = NULL;
+  v->partial = NULL;
 
   /* Build new environment */
   v->env = lenv_new();
@@ -229,12 +703,14 @@ lval *lval_lambda(lval *formals, lval *body) {
   /* Set Formals and Body */
   v->formals = formals;
   v->body = body;
+  v->code = NULL;
+  v->node = NULL;
   return v;
 }
 
 lval *lval_copy(lval *v) {
 
-  lval *x = malloc(sizeof(lval));
+  lval *x = lval_alloc();
   x->type = v->type;
 
   switch (v->type) {
@@ -243,11 +719,25 @@ lval *lval_copy(lval *v) {
   case LVAL_FUN:
     if (v->builtin) {
       x->builtin = v->builtin;
+      x->op = v->op;
+      x->memo = v->memo;
+      if (x->memo) {
+        x->memo->refs++;
+      }
+      x->partial = v->partial;
+      if (x->partial) {
+        x->partial->refs++;
+      }
     } else {
       x->builtin = NULL;
+      x->memo = NULL;
+      x->partial = NULL;
       x->env = lenv_copy(v->env);
       x->formals = lval_copy(v->formals);
       x->body = lval_copy(v->body);
+      /* Compiled code is shared between copies */
+      x->code = v->code ? lcode_retain(v->code) : NULL;
+      x->node = v->node ? lnode_retain(v->node) : NULL;
     }
     break;
   case LVAL_NUM:
@@ -279,14 +769,54 @@ lval *lval_copy(lval *v) {
       x->cell[i] = lval_copy(v->cell[i]);
     }
     break;
+
+  /* Vectors share their storage, sequences never change */
+  case LVAL_VEC:
+    x->vec = v->vec;
+    x->vec->refs++;
+    break;
+  case LVAL_SEQ:
+    x->seq = v->seq;
+    x->seq->refs++;
+    break;
+  case LVAL_FWD:
+    x->env = v->env;
+    x->num = v->num;
+    break;
   }
 
   return x;
 }
 
+/* A copy of 'f' to call with 'n' arguments. Compiled lambdas taking
+ * exactly 'n' arguments run without their body, so it is not copied. */
+lval *lval_callee(lval *f, int n) {
+  if (f->type != LVAL_FUN || f->builtin || (!f->code && !f->node) ||
+      f->formals->count != n) {
+    return lval_copy(f);
+  }
+  for (int i = 0; i < n; i++) {
+    if (strcmp(f->formals->cell[i]->sym, "&") == 0) {
+      return lval_copy(f);
+    }
+  }
+  lval *x = lval_alloc();
+  x->type = LVAL_FUN;
+  x->builtin = NULL;
+  x->memo = NULL;
+  x->partial = NULL;
+  x->env = lenv_copy(f->env);
+  x->formals = lval_copy(f->formals);
+  x->body = lval_qexpr();
+  x->code = f->code ? lcode_retain(f->code) : NULL;
+  x->node = f->node ? lnode_retain(f->node) : NULL;
+  return x;
+}
+
 lenv *lenv_copy(lenv *e) {
   lenv *n = malloc(sizeof(lenv));
   n->par = e->par;
+  n->ns = e->ns;
   n->count = e->count;
   n->syms = malloc(sizeof(char *) * n->count);
   n->vals = malloc(sizeof(lval *) * n->count);
@@ -327,17 +857,36 @@ void lval_del(lval *v) {
     free(v->cell);
     break;
 
+  case LVAL_VEC:
+    lvec_release(v->vec);
+    break;
+  case LVAL_SEQ:
+    lseq_release(v->seq);
+    break;
+
   case LVAL_FUN:
+    if (v->memo) {
+      lmemo_release(v->memo);
+    }
+    if (v->partial) {
+      lpartial_release(v->partial);
+    }
     if (!v->builtin) {
       lenv_del(v->env);
       lval_del(v->formals);
       lval_del(v->body);
+      if (v->code) {
+        lcode_release(v->code);
+      }
+      if (v->node) {
+        lnode_release(v->node);
+      }
     }
     break;
   }
 
   /* Free the memory allocated for the "lval" struct itself */
-  free(v);
+  lval_free(v);
 }
 
 void lenv_del(lenv *e) {
@@ -350,23 +899,128 @@ void lenv_del(lenv *e) {
   free(e);
 }
 
-lval *lenv_get(lenv *e, lval *k) {
-
-  /* Iterate over all items in environment */
+/* Find the value bound to 'sym' in 'e' only, without copying it */
+/* Where 'sym' is bound in 'e' itself, or NULL */
+lval **lenv_slot(lenv *e, char *sym) {
   for (int i = 0; i < e->count; i++) {
-    /* Check if the stored string matches the symbol string */
-    /* If it does, return a copy of the value */
-    if (strcmp(e->syms[i], k->sym) == 0) {
-      return lval_copy(e->vals[i]);
+    if (strcmp(e->syms[i], sym) == 0) {
+      return &e->vals[i];
+    }
+  }
+  return NULL;
+}
+
+lval *lenv_find(lenv *e, char *sym) {
+  lval **slot = lenv_slot(e, sym);
+  return slot ? *slot : NULL;
+}
+
+/* The binding at 'slot' for 'sym', or for an import the binding in the
+ * namespace of its module, NULL when the module no longer binds it */
+lval **lenv_follow(lval **slot, char *sym) {
+  while (slot && (*slot)->type == LVAL_FWD) {
+    lval *fwd = *slot;
+    lenv *ns = fwd->env;
+    if (fwd->num < ns->count && strcmp(ns->syms[fwd->num], sym) == 0) {
+      slot = &ns->vals[fwd->num];
+    } else if ((slot = lenv_slot(ns, sym))) {
+      fwd->num = slot - ns->vals;
     }
   }
+  return slot;
+}
 
-  /* If no symbol check in parent otherwise error */
-  if (e->par) {
-    return lenv_get(e->par, k);
-  } else {
-    return lval_err("Unbound Symbol '%s'", k->sym);
+/* Namespace of the innermost module environment in the chain of 'e' */
+lenv *lenv_ns(lenv *e) {
+  while (e && !e->ns) {
+    e = e->par;
+  }
+  return e ? e->ns : NULL;
+}
+
+/* Inline cache of a lookup site: where its symbol was last found in a
+ * root or module environment */
+typedef struct {
+  lenv *env;
+  int slot;
+} lcache;
+
+/* Find 'sym' in 'e', trying the slot recorded in 'c' first. The slot is
+ * only used while it holds the symbol, as bindings move down when one is
+ * removed, see lenv_unbind. */
+lval **lcache_slot(lcache *c, lenv *e, char *sym) {
+  if (!c) {
+    return lenv_slot(e, sym);
+  }
+  if (c->env == e && c->slot < e->count &&
+      strcmp(e->syms[c->slot], sym) == 0) {
+    return &e->vals[c->slot];
+  }
+  lval **v = lenv_slot(e, sym);
+  if (v) {
+    c->env = e;
+    c->slot = v - e->vals;
   }
+  return v;
+}
+
+/* Find where 'k' is bound as seen from 'e', or NULL, following imports to
+ * their module. The large root and module environments are searched
+ * through the cache 'c' of the lookup site when there is one. */
+lval **lenv_cached(lenv *e, lval *k, lcache *c) {
+  lenv *from = e;
+  lenv *root = e;
+  lenv *ns = lenv_ns(e);
+
+  /* Walk the chain of environments, checking the module namespace of the
+   * innermost module function just before the root environment */
+  while (e) {
+    lval **v;
+    if (!e->par && ns && ns != e && (v = lcache_slot(c, ns, k->sym))) {
+      return lenv_follow(v, k->sym);
+    }
+    if ((v = e->par && e != ns ? lenv_slot(e, k->sym)
+                               : lcache_slot(c, e, k->sym))) {
+      return lenv_follow(v, k->sym);
+    }
+    if (e == ns) {
+      ns = NULL;
+    }
+    root = e;
+    e = e->par;
+  }
+
+  /* A stdlib definition not made yet in the lazy mode is made now */
+  if (lstub_force(root, k->sym)) {
+    return lenv_cached(from, k, c);
+  }
+  return NULL;
+}
+
+lval **lenv_lookup(lenv *e, lval *k) { return lenv_cached(e, k, NULL); }
+
+/* Find the value 'k' is bound to from 'e' without copying it, or NULL */
+lval *lenv_ref(lenv *e, lval *k) {
+  lval **slot = lenv_lookup(e, k);
+  return slot ? *slot : NULL;
+}
+
+lval *lenv_get(lenv *e, lval *k) {
+  lval *v = lenv_ref(e, k);
+  if (v) {
+    return lval_copy(v);
+  }
+  return lval_err("Unbound Symbol '%s'", k->sym);
+}
+
+/* The value of 'k' as seen from 'e', looked up through the cache 'c', to
+ * call with 'n' arguments or -1 */
+lval *lenv_callee(lenv *e, lval *k, lcache *c, int n) {
+  lval **slot = lenv_cached(e, k, c);
+  if (slot) {
+    return lval_callee(*slot, n);
+  }
+  return lval_err("Unbound Symbol '%s'", k->sym);
 }
 
 void lenv_put(lenv *e, lval *k, lval *v) {
@@ -395,7 +1049,67 @@ void lenv_put(lenv *e, lval *k, lval *v) {
   strcpy(e->syms[e->count - 1], k->sym);
 }
 
+/* Store 'v', which is taken, in the binding at 'slot'. Numbers replace the
+ * Number bound in place. */
+void lval_assign(lval **slot, lval *v) {
+  if ((*slot)->type == LVAL_NUM && v->type == LVAL_NUM) {
+    (*slot)->num = v->num;
+    lval_del(v);
+    return;
+  }
+  lval_del(*slot);
+  *slot = v;
+}
+
+/* Bind 'sym' to 'v', which is taken, in 'e' itself */
+void lenv_bind(lenv *e, char *sym, lval *v) {
+  lval **slot = lenv_slot(e, sym);
+  if (slot) {
+    lval_assign(slot, v);
+    return;
+  }
+  e->count++;
+  e->vals = realloc(e->vals, sizeof(lval *) * e->count);
+  e->syms = realloc(e->syms, sizeof(char *) * e->count);
+  e->vals[e->count - 1] = v;
+  e->syms[e->count - 1] = malloc(strlen(sym) + 1);
+  strcpy(e->syms[e->count - 1], sym);
+}
+
+/* Remove the binding of 'sym' in 'e' itself, if there is one */
+void lenv_unbind(lenv *e, char *sym) {
+  lval **slot = lenv_slot(e, sym);
+  if (!slot) {
+    return;
+  }
+  int i = slot - e->vals;
+  lval_del(e->vals[i]);
+  free(e->syms[i]);
+  e->count--;
+  memmove(e->vals + i, e->vals + i + 1, sizeof(lval *) * (e->count - i));
+  memmove(e->syms + i, e->syms + i + 1, sizeof(char *) * (e->count - i));
+}
+
+/* Change the nearest binding of 'k' seen from 'e' to 'v', which is taken.
+ * Returns an error if there is none, otherwise NULL. */
+lval *lenv_set(lenv *e, lval *k, lval *v) {
+  lval **slot = lenv_lookup(e, k);
+  if (!slot) {
+    lval_del(v);
+    return lval_err("Unbound Symbol '%s'", k->sym);
+  }
+  lval_assign(slot, v);
+  return NULL;
+}
+
 void lenv_def(lenv *e, lval *k, lval *v) {
+  /* Definitions inside a module go to its namespace */
+  lenv *ns = lenv_ns(e);
+  if (ns) {
+    lenv_put(ns, k, v);
+    return;
+  }
+
   /* Iterate till e has no parent */
   while (e->par) {
     e = e->par;
@@ -427,6 +1141,7 @@ lval *lval_read_str(mpc_ast_t *t) {
 }
 
 lval *lval_add(lval *v, lval *x) {
+  lval_adds++;
   v->count++;
   v->cell = realloc(v->cell, sizeof(lval *) * v->count);
   v->cell[v->count - 1] = x;
@@ -485,8 +1200,236 @@ lval *lval_read(mpc_ast_t *t) {
   return x;
 }
 
+/* Reader: one pass over the source text building lvals directly, with the
+ * grammar of the mpc parser in mlisp_init, which is still used instead
+ * with --mpc-reader */
+int lread_mpc = 0;
+
+/* Most lists read inside each other */
+#define LREAD_DEPTH 10000
+
+typedef struct {
+  const char *name;
+  const char *src;
+  const char *s;
+  const char *end;
+  /* What could not be read */
+  lval *err;
+  /* Lists being read */
+  int depth;
+} lreader;
+
+int lread_symbol_char(char c) {
+  return isalnum((unsigned char)c) || (c && strchr("_+-*/\\=<>!&|", c));
+}
+
+/* Fail with an error at 'at', located by line and column */
+lval *lread_err(lreader *r, const char *at, char *msg, char c) {
+  int line = 1;
+  int col = 1;
+  for (const char *s = r->src; s < at; s++) {
+    if (*s == '\n') {
+      line++;
+      col = 1;
+    } else {
+      col++;
+    }
+  }
+  r->err = c ? lval_err("%s:%d:%d: %s '%c'", r->name, line, col, msg, c)
+             : lval_err("%s:%d:%d: %s", r->name, line, col, msg);
+  return NULL;
+}
+
+/* Skip whitespace and comments */
+void lread_space(lreader *r) {
+  while (r->s < r->end) {
+    if (*r->s == ';') {
+      while (r->s < r->end && *r->s != '\n' && *r->s != '\r') {
+        r->s++;
+      }
+    } else if (isspace((unsigned char)*r->s)) {
+      r->s++;
+    } else {
+      return;
+    }
+  }
+}
+
+lval *lread_num(lreader *r) {
+  /* Accumulate negatively so the most negative number fits */
+  const char *start = r->s;
+  int neg = *r->s == '-';
+  r->s += neg;
+  long n = 0;
+  int over = 0;
+  for (; r->s < r->end && isdigit((unsigned char)*r->s); r->s++) {
+    int d = *r->s - '0';
+    if (n < (LONG_MIN + d) / 10) {
+      over = 1;
+    } else {
+      n = n * 10 - d;
+    }
+  }
+  if (!neg && n == LONG_MIN) {
+    over = 1;
+  }
+  if (over) {
+    return lval_err("Invalid number. Got '%.*s'.", (int)(r->s - start),
+                    start);
+  }
+  return lval_num(neg ? n : -n);
+}
+
+lval *lread_str(lreader *r) {
+  /* Find the closing quote, unescaping only shortens the text */
+  const char *start = r->s;
+  const char *close = start + 1;
+  while (close < r->end && *close != '"') {
+    close += *close == '\\' ? 2 : 1;
+  }
+  if (close >= r->end) {
+    return lread_err(r, start, "Unterminated string", 0);
+  }
+
+  char *out = malloc(close - start);
+  int n = 0;
+  for (r->s++; r->s < close;) {
+    char c = *r->s++;
+    if (c == '\\') {
+      /* Escapes mpcf_unescape knows, where it drops '\0' */
+      const char *esc = strchr("abfnrtv\\'\"0", *r->s);
+      if (esc && *r->s) {
+        c = "\a\b\f\n\r\t\v\\'\"\0"[esc - "abfnrtv\\'\"0"];
+        r->s++;
+        if (!c) {
+          continue;
+        }
+      }
+    }
+    out[n++] = c;
+  }
+  r->s++;
+  out[n] = '\0';
+
+  lval *v = lval_alloc();
+  v->type = LVAL_STR;
+  v->str = out;
+  return v;
+}
+
+lval *lread_expr(lreader *r);
+
+/* Expressions up to 'close', or the end of the text when it is 0, added to
+ * 'x' */
+lval *lread_list(lreader *r, lval *x, char close) {
+  const char *open = close ? r->s - 1 : r->s;
+  int cap = 0;
+  while (1) {
+    lread_space(r);
+    if (r->s == r->end) {
+      if (!close) {
+        break;
+      }
+      lval_del(x);
+      return lread_err(r, open, "Unclosed", *open);
+    }
+    if (*r->s == close) {
+      r->s++;
+      break;
+    }
+    lval *y = lread_expr(r);
+    if (!y) {
+      lval_del(x);
+      return NULL;
+    }
+    if (x->count == cap) {
+      cap = cap ? cap * 2 : 4;
+      x->cell = realloc(x->cell, sizeof(lval *) * cap);
+    }
+    x->cell[x->count++] = y;
+  }
+  lval_adds += x->count;
+  return x;
+}
+
+/* The expression at the reader, or NULL. Numbers out of range are read
+ * as Errors, like the mpc parser does. */
+lval *lread_expr(lreader *r) {
+  char c = *r->s;
+  const char *at = r->s;
+  if (isdigit((unsigned char)c) ||
+      (c == '-' && r->s + 1 < r->end && isdigit((unsigned char)r->s[1]))) {
+    return lread_num(r);
+  }
+  if (lread_symbol_char(c)) {
+    while (r->s < r->end && lread_symbol_char(*r->s)) {
+      r->s++;
+    }
+    lval *x = lval_alloc();
+    x->type = LVAL_SYM;
+    x->sym = malloc(r->s - at + 1);
+    memcpy(x->sym, at, r->s - at);
+    x->sym[r->s - at] = '\0';
+    return x;
+  }
+  if (c == '"') {
+    return lread_str(r);
+  }
+  if (c == '(' || c == '{') {
+    if (r->depth == LREAD_DEPTH || lstack_full()) {
+      return lread_err(r, at, "Maximum nesting depth exceeded at", c);
+    }
+    r->s++;
+    r->depth++;
+    lval *x = c == '(' ? lread_list(r, lval_sexpr(), ')')
+                       : lread_list(r, lval_qexpr(), '}');
+    r->depth--;
+    return x;
+  }
+  return lread_err(r, at, "Unexpected", c);
+}
+
+/* Every expression in 'len' characters at 'src', in an S-Expression, or an
+ * Error locating what could not be read. 'name' is used in errors. */
+lval *lread(const char *name, const char *src, size_t len) {
+  if (lread_mpc) {
+    mpc_result_t r;
+    if (!mpc_nparse(name, src, len, Mlisp, &r)) {
+      char *msg = mpc_err_string(r.error);
+      mpc_err_delete(r.error);
+      lval *err = lval_err("%s", msg);
+      free(msg);
+      return err;
+    }
+    lval *x = lval_read(r.output);
+    mpc_ast_delete(r.output);
+    return x;
+  }
+
+  lreader r = {name, src, src, src + len, NULL, 0};
+  lval *x = lread_list(&r, lval_sexpr(), 0);
+  return x ? x : r.err;
+}
+
+/* Read every expression in the file at 'path' */
+lval *lread_file(char *path) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    return lval_err("Unable to open file '%s'", path);
+  }
+  fseek(f, 0, SEEK_END);
+  long n = ftell(f);
+  rewind(f);
+  char *src = malloc(n > 0 ? n : 1);
+  n = n > 0 ? fread(src, 1, n, f) : 0;
+  fclose(f);
+  lval *x = lread(path, src, n);
+  free(src);
+  return x;
+}
+
 char *lval_expr_to_str(lval *v, char open, char close) {
-  char *out = malloc(sizeof(char) * 2);
+  char *out = malloc(sizeof(char) * 3);
   out[0] = open;
   out[1] = '\0';
   for (int i = 0; i < v->count; i++) {
@@ -541,15 +1484,39 @@ char *lval_to_str(lval *v) {
     return lval_expr_to_str(v, '(', ')');
   case LVAL_QEXPR:
     return lval_expr_to_str(v, '{', '}');
-  case LVAL_FUN:
-    if (v->builtin) {
-      char *builtin = "<builtin>";
+  case LVAL_VEC: {
+    lval items;
+    items.count = v->vec->count;
+    items.cell = v->vec->items;
+    return lval_expr_to_str(&items, '[', ']');
+  }
+  case LVAL_SEQ: {
+    char *seq = "<sequence>";
+    out = malloc(sizeof(char) * (strlen(seq) + 1));
+    strcpy(out, seq);
+    return out;
+  }
+  case LVAL_FUN: {
+    /* Partial applications show as what they apply */
+    int given;
+    lval *f = lpartial_root(v, &given);
+    if (f->builtin) {
+      char *builtin = v->partial ? "<partial>"
+                      : v->memo  ? "<memo>"
+                                 : "<builtin>";
       out = malloc(sizeof(char) * (strlen(builtin) + 1));
       sprintf(out, "%s", builtin);
     } else {
+      /* The lambda taking the arguments not given yet */
+      int any;
+      int skip = lval_arity(f, &any);
+      skip = given < skip ? given : skip;
+      lval rest;
+      rest.count = f->formals->count - skip;
+      rest.cell = f->formals->cell + skip;
       char *format = "(\\ %s %s)";
-      char *formals = lval_to_str(v->formals);
-      char *body = lval_to_str(v->body);
+      char *formals = lval_expr_to_str(&rest, '{', '}');
+      char *body = lval_to_str(f->body);
       out = malloc(sizeof(char) *
                    (strlen(format) + strlen(formals) + strlen(body) + 1));
       sprintf(out, format, formals, body);
@@ -558,6 +1525,7 @@ char *lval_to_str(lval *v) {
     }
     return out;
   }
+  }
   return NULL;
 }
 
@@ -595,57 +1563,87 @@ lval *lval_take(lval *v, int i) {
   return x;
 }
 
-lval *builtin_op(lenv *e, lval *a, char *op) {
-
-  /* Ensure all arguments are numbers */
+/* Check that every argument of arithmetic builtin 'op' is a Number */
+lval *builtin_op_check(lval *a, int op) {
+  if (a->count == 0) {
+    lval_del(a);
+    return lval_err("Function '%s' passed no arguments.", lbuiltins[op].name);
+  }
   for (int i = 0; i < a->count; i++) {
     if (a->cell[i]->type != LVAL_NUM) {
       int tp = a->cell[i]->type;
       lval_del(a);
       return lval_err("Function '%s' passed incorrect type for argument %i. "
                       "Got %s, Expected %s.",
-                      op, i, ltype_name(tp), ltype_name(LVAL_NUM));
+                      lbuiltins[op].name, i, ltype_name(tp),
+                      ltype_name(LVAL_NUM));
     }
   }
+  return NULL;
+}
 
-  /* Pop the first element */
-  lval *x = lval_pop(a, 0);
-
-  /* If no arguments and sub then perform unary negation */
-  if ((strcmp(op, "-") == 0) && a->count == 0) {
-    x->num = -x->num;
+/* Specialized kernel for each arithmetic operator. The result reuses the
+ * first argument so no new lval is allocated. */
+#define LARITH_KERNEL(func, op, stmt)                                          \
+  lval *func(lenv *e, lval *a) {                                               \
+    lval *err = builtin_op_check(a, op);                                       \
+    if (err) {                                                                 \
+      return err;                                                              \
+    }                                                                          \
+    long x = a->cell[0]->num;                                                  \
+    for (int i = 1; i < a->count; i++) {                                       \
+      long y = a->cell[i]->num;                                                \
+      stmt;                                                                    \
+    }                                                                          \
+    lval *r = lval_pop(a, 0);                                                  \
+    r->num = x;                                                                \
+    lval_del(a);                                                               \
+    return r;                                                                  \
   }
 
-  /* While there are still elements remaining */
-  while (a->count > 0) {
-
-    /* Pop the next element */
-    lval *y = lval_pop(a, 0);
+LARITH_KERNEL(builtin_add, LOP_ADD, x += y)
+LARITH_KERNEL(builtin_mul, LOP_MUL, x *= y)
 
-    if (strcmp(op, "+") == 0) {
-      x->num += y->num;
-    }
-    if (strcmp(op, "-") == 0) {
-      x->num -= y->num;
-    }
-    if (strcmp(op, "*") == 0) {
-      x->num *= y->num;
-    }
-    if (strcmp(op, "/") == 0) {
-      if (y->num == 0) {
-        lval_del(x);
-        lval_del(y);
-        x = lval_err("Division By Zero!");
-        break;
-      }
-      x->num /= y->num;
-    }
+lval *builtin_sub(lenv *e, lval *a) {
+  lval *err = builtin_op_check(a, LOP_SUB);
+  if (err) {
+    return err;
+  }
 
-    lval_del(y);
+  /* If no arguments and sub then perform unary negation */
+  long x = a->cell[0]->num;
+  if (a->count == 1) {
+    x = -x;
+  }
+  for (int i = 1; i < a->count; i++) {
+    x -= a->cell[i]->num;
   }
 
+  lval *r = lval_pop(a, 0);
+  r->num = x;
   lval_del(a);
-  return x;
+  return r;
+}
+
+lval *builtin_div(lenv *e, lval *a) {
+  lval *err = builtin_op_check(a, LOP_DIV);
+  if (err) {
+    return err;
+  }
+
+  long x = a->cell[0]->num;
+  for (int i = 1; i < a->count; i++) {
+    if (a->cell[i]->num == 0) {
+      lval_del(a);
+      return lval_err("Division By Zero!");
+    }
+    x /= a->cell[i]->num;
+  }
+
+  lval *r = lval_pop(a, 0);
+  r->num = x;
+  lval_del(a);
+  return r;
 }
 
 lval *builtin_head(lenv *e, lval *a) {
@@ -692,7 +1690,8 @@ lval *builtin_list(lenv *e, lval *a) {
   return a;
 }
 
-lval *builtin_eval(lenv *e, lval *a) {
+/* Check the arguments of 'eval' and return the expression to evaluate */
+lval *lval_eval_expr(lval *a) {
   LASSERT(a, a->count == 1,
           "Function 'eval' passed too many arguments. Got %i, "
           "Expected %i.",
@@ -703,9 +1702,11 @@ lval *builtin_eval(lenv *e, lval *a) {
 
   lval *x = lval_take(a, 0);
   x->type = LVAL_SEXPR;
-  return lval_eval(e, x);
+  return x;
 }
 
+lval *builtin_eval(lenv *e, lval *a) { return lval_eval(e, lval_eval_expr(a)); }
+
 lval *lval_join(lval *x, lval *y) {
 
   /* For each cell in 'y' add it to 'x' */
@@ -736,15 +1737,61 @@ lval *builtin_join(lenv *e, lval *a) {
   return x;
 }
 
-lval *builtin_add(lenv *e, lval *a) { return builtin_op(e, a, "+"); }
+/* Opcode of the builtin named 'sym' if it can be folded, otherwise -1 */
+int lfold_op(char *sym) {
+  for (int op = 0; op < LOP_COUNT; op++) {
+    if (strcmp(lbuiltins[op].name, sym) != 0) {
+      continue;
+    }
+    switch (op) {
+    case LOP_LIST:
+    case LOP_HEAD:
+    case LOP_TAIL:
+    case LOP_JOIN:
+    case LOP_ADD:
+    case LOP_SUB:
+    case LOP_MUL:
+    case LOP_DIV:
+    case LOP_LT:
+    case LOP_LTE:
+    case LOP_GT:
+    case LOP_GTE:
+    case LOP_EQ:
+    case LOP_NE:
+      return op;
+    }
+  }
+  return -1;
+}
 
-lval *builtin_sub(lenv *e, lval *a) { return builtin_op(e, a, "-"); }
+/* Whether 'sym' names a special form the compilers inline */
+int lform_inlined(char *sym) {
+  return strcmp(sym, "if") == 0 || strcmp(sym, "&&") == 0 ||
+         strcmp(sym, "||") == 0 || strcmp(sym, "while") == 0 ||
+         strcmp(sym, "set!") == 0 || strcmp(sym, "dotimes") == 0 ||
+         strcmp(sym, "for-each") == 0;
+}
 
-lval *builtin_mul(lenv *e, lval *a) { return builtin_op(e, a, "*"); }
+/* Evaluate the elements of special form 'x', which may be a lambda body, as
+ * the S-Expression they make up */
+lval *lform_eval(lenv *e, lval *x) {
+  lval *v = lval_copy(x);
+  v->type = LVAL_SEXPR;
+  return lval_eval(e, v);
+}
 
-lval *builtin_div(lenv *e, lval *a) { return builtin_op(e, a, "/"); }
+/* Note that 'sym' may be bound to something else than the builtin */
+void lfold_forget(char *sym) {
+  if (lfold_intact && lfold_op(sym) >= 0) {
+    lfold_intact = 0;
+  }
+  if (lform_intact && lform_inlined(sym)) {
+    lform_intact = 0;
+  }
+}
 
-lval *builtin_var(lenv *e, lval *a, char *func) {
+lval *builtin_var(lenv *e, lval *a, int op) {
+  char *func = lbuiltins[op].name;
   LASSERT_TYPE(func, a, 0, LVAL_QEXPR);
 
   lval *syms = a->cell[0];
@@ -761,12 +1808,19 @@ lval *builtin_var(lenv *e, lval *a, char *func) {
           func, syms->count, a->count - 1);
 
   for (int i = 0; i < syms->count; i++) {
+    lfold_forget(syms->cell[i]->sym);
+
     /* If 'def' define in globally. If 'put' define in locally */
-    if (strcmp(func, "def") == 0) {
+    if (op == LOP_DEF) {
       lenv_def(e, syms->cell[i], a->cell[i + 1]);
-    }
-
-    if (strcmp(func, "=") == 0) {
+    } else if (op == LOP_SET) {
+      /* 'set!' changes the binding already seen */
+      lval *err = lenv_set(e, syms->cell[i], lval_copy(a->cell[i + 1]));
+      if (err) {
+        lval_del(a);
+        return err;
+      }
+    } else {
       lenv_put(e, syms->cell[i], a->cell[i + 1]);
     }
   }
@@ -775,9 +1829,26 @@ lval *builtin_var(lenv *e, lval *a, char *func) {
   return lval_sexpr();
 }
 
-lval *builtin_def(lenv *e, lval *a) { return builtin_var(e, a, "def"); }
+lval *builtin_def(lenv *e, lval *a) { return builtin_var(e, a, LOP_DEF); }
+
+lval *builtin_put(lenv *e, lval *a) { return builtin_var(e, a, LOP_PUT); }
+
+lval *builtin_set(lenv *e, lval *a) { return builtin_var(e, a, LOP_SET); }
 
-lval *builtin_put(lenv *e, lval *a) { return builtin_var(e, a, "="); }
+/* Lambda created in 'e', with its body compiled for the engine */
+lval *lenv_lambda(lenv *e, lval *formals, lval *body) {
+  /* Lambdas created inside a module keep seeing its namespace */
+  lval *f = lval_lambda(formals, body);
+  f->env->ns = lenv_ns(e);
+
+  /* Compile the body once, copies of the lambda share the code */
+  if (lengine == LENGINE_VM) {
+    f->code = lcode_compile(f->formals, f->body);
+  } else if (lengine == LENGINE_CLOSURE) {
+    f->node = lnode_compile(f->formals, f->body);
+  }
+  return f;
+}
 
 lval *builtin_lambda(lenv *e, lval *a) {
   /* Check Two arguments, each of which are Q-Expressions */
@@ -792,12 +1863,11 @@ lval *builtin_lambda(lenv *e, lval *a) {
             ltype_name(a->cell[0]->cell[i]->type), ltype_name(LVAL_SYM));
   }
 
-  /* Pop first two arguments and pass them to lval_lambda */
+  /* Pop first two arguments and pass them to lenv_lambda */
   lval *formals = lval_pop(a, 0);
   lval *body = lval_pop(a, 0);
   lval_del(a);
-
-  return lval_lambda(formals, body);
+  return lenv_lambda(e, formals, body);
 }
 
 lval *builtin_fun(lenv *e, lval *a) {
@@ -837,37 +1907,22 @@ lval *builtin_fun(lenv *e, lval *a) {
   return fun;
 }
 
-lval *builtin_ord(lenv *e, lval *a, char *func) {
-  LASSERT_NUM(func, a, 2);
-  LASSERT_TYPE(func, a, 0, LVAL_NUM);
-  LASSERT_TYPE(func, a, 1, LVAL_NUM);
-
-  long n1 = a->cell[0]->num;
-  long n2 = a->cell[1]->num;
-
-  lval_del(a);
-
-  if (strcmp(func, "<") == 0) {
-    return lval_num(n1 < n2);
-  }
-  if (strcmp(func, "<=") == 0) {
-    return lval_num(n1 <= n2);
-  }
-
-  if (strcmp(func, ">") == 0) {
-    return lval_num(n1 > n2);
-  }
-  if (strcmp(func, ">=") == 0) {
-    return lval_num(n1 >= n2);
+/* Specialized kernel for each ordering operator */
+#define LORD_KERNEL(func, op, cmp)                                             \
+  lval *func(lenv *e, lval *a) {                                               \
+    LASSERT_NUM(lbuiltins[op].name, a, 2);                                     \
+    LASSERT_TYPE(lbuiltins[op].name, a, 0, LVAL_NUM);                          \
+    LASSERT_TYPE(lbuiltins[op].name, a, 1, LVAL_NUM);                          \
+    lval *r = lval_pop(a, 0);                                                  \
+    r->num = r->num cmp a->cell[0]->num;                                       \
+    lval_del(a);                                                               \
+    return r;                                                                  \
   }
 
-  return lval_err("Undefined operator: '%s'", func);
-}
-
-lval *builtin_lt(lenv *e, lval *a) { return builtin_ord(e, a, "<"); }
-lval *builtin_lte(lenv *e, lval *a) { return builtin_ord(e, a, "<="); }
-lval *builtin_gt(lenv *e, lval *a) { return builtin_ord(e, a, ">"); }
-lval *builtin_gte(lenv *e, lval *a) { return builtin_ord(e, a, ">="); }
+LORD_KERNEL(builtin_lt, LOP_LT, <)
+LORD_KERNEL(builtin_lte, LOP_LTE, <=)
+LORD_KERNEL(builtin_gt, LOP_GT, >)
+LORD_KERNEL(builtin_gte, LOP_GTE, >=)
 
 int lval_eq(lval *x, lval *y) {
 
@@ -890,8 +1945,14 @@ int lval_eq(lval *x, lval *y) {
 
   /* If builtin compare, otherwise compare formals and body */
   case LVAL_FUN:
+    if (x->partial || y->partial) {
+      return x->partial && y->partial &&
+             lval_eq(x->partial->fn, y->partial->fn) &&
+             lval_eq(x->partial->args, y->partial->args);
+    }
     if (x->builtin || y->builtin) {
-      return x->builtin == y->builtin;
+      return x->builtin && y->builtin && x->op == y->op &&
+             x->memo == y->memo;
     } else {
       return lval_eq(x->formals, y->formals) && lval_eq(x->body, y->body);
     }
@@ -914,47 +1975,68 @@ int lval_eq(lval *x, lval *y) {
     /* Otherwise lists must be equal */
     return 1;
     break;
+
+  /* Vectors are equal when their elements are */
+  case LVAL_VEC:
+    if (x->vec->count != y->vec->count) {
+      return 0;
+    }
+    for (int i = 0; i < x->vec->count; i++) {
+      if (!lval_eq(x->vec->items[i], y->vec->items[i])) {
+        return 0;
+      }
+    }
+    return 1;
+
+  /* Sequences are equal when they are the same */
+  case LVAL_SEQ:
+    return x->seq == y->seq;
   }
   return 0;
 }
 
-lval *builtin_cmp(lenv *e, lval *a, char *op) {
-  LASSERT_NUM(op, a, 2);
-  int r;
-  if (strcmp(op, "==") == 0) {
-    r = lval_eq(a->cell[0], a->cell[1]);
-  }
-  if (strcmp(op, "!=") == 0) {
-    r = !lval_eq(a->cell[0], a->cell[1]);
+/* Check whether list 'l' contains an element equal to 'x' */
+int lval_contains(lval *l, lval *x) {
+  for (int i = 0; i < l->count; i++) {
+    if (lval_eq(l->cell[i], x)) {
+      return 1;
+    }
   }
+  return 0;
+}
+
+lval *builtin_eq(lenv *e, lval *a) {
+  LASSERT_NUM("==", a, 2);
+  int r = lval_eq(a->cell[0], a->cell[1]);
   lval_del(a);
   return lval_num(r);
 }
 
-lval *builtin_eq(lenv *e, lval *a) { return builtin_cmp(e, a, "=="); }
-
-lval *builtin_ne(lenv *e, lval *a) { return builtin_cmp(e, a, "!="); }
+lval *builtin_ne(lenv *e, lval *a) {
+  LASSERT_NUM("!=", a, 2);
+  int r = !lval_eq(a->cell[0], a->cell[1]);
+  lval_del(a);
+  return lval_num(r);
+}
 
-lval *builtin_bool(lenv *e, lval *a, char *func) {
+/* Shared kernel of '&&' and '||': 'stop' is the value that ends the scan */
+lval *builtin_bool(lenv *e, lval *a, int op, int stop) {
+  char *func = lbuiltins[op].name;
   LASSERT(a, a->count >= 2,
           "Boolean operation '%s' takes at least 2 arguments.", func);
 
-  int isAnd = (strcmp(func, "&&") == 0);
-  int r = (isAnd ? 1 : 0);
+  int r = !stop;
 
+  /* Arguments are evaluated in order until one decides the result */
   for (int i = 0; i < a->count; i++) {
     a->cell[i] = lval_eval(e, a->cell[i]);
+    if (a->cell[i]->type == LVAL_ERR) {
+      return lval_take(a, i);
+    }
     LASSERT_TYPE(func, a, i, LVAL_NUM);
-    if (isAnd) {
-      if (!a->cell[i]->num) {
-        r = 0;
-        break;
-      }
-    } else {
-      if (a->cell[i]->num) {
-        r = 1;
-        break;
-      }
+    if (!a->cell[i]->num == !stop) {
+      r = stop;
+      break;
     }
   }
 
@@ -963,9 +2045,9 @@ lval *builtin_bool(lenv *e, lval *a, char *func) {
   return lval_num(r);
 }
 
-lval *builtin_and(lenv *e, lval *a) { return builtin_bool(e, a, "&&"); }
+lval *builtin_and(lenv *e, lval *a) { return builtin_bool(e, a, LOP_AND, 0); }
 
-lval *builtin_or(lenv *e, lval *a) { return builtin_bool(e, a, "||"); }
+lval *builtin_or(lenv *e, lval *a) { return builtin_bool(e, a, LOP_OR, 1); }
 
 lval *builtin_not(lenv *e, lval *a) {
   LASSERT_NUM("!", a, 1);
@@ -978,332 +2060,5901 @@ lval *builtin_not(lenv *e, lval *a) {
   return lval_num(r);
 }
 
-lval *builtin_if(lenv *e, lval *a) {
+/* Check the arguments of 'if' and return the branch to evaluate */
+lval *lval_if_branch(lval *a) {
   LASSERT_NUM("if", a, 3);
   LASSERT_TYPE("if", a, 0, LVAL_NUM);
   LASSERT_TYPE("if", a, 1, LVAL_QEXPR);
   LASSERT_TYPE("if", a, 2, LVAL_QEXPR);
 
-  /* Mark Both Expressions as evaluable */
-  lval *x;
-  a->cell[1]->type = LVAL_SEXPR;
-  a->cell[2]->type = LVAL_SEXPR;
-
-  if (a->cell[0]->num) {
-    /* If condition is true evaluate first expression */
-    x = lval_eval(e, lval_pop(a, 1));
-  } else {
-    /* Otherwise evaluate second expression */
-    x = lval_eval(e, lval_pop(a, 2));
-  }
+  /* If condition is true take first expression, otherwise the second */
+  lval *x = lval_take(a, a->cell[0]->num ? 1 : 2);
 
-  /* Delete argument list and return */
-  lval_del(a);
+  /* Mark Expression as evaluable */
+  x->type = LVAL_SEXPR;
   return x;
 }
 
-lval *builtin_load(lenv *e, lval *a) {
-  LASSERT_NUM("load", a, 1);
-  LASSERT_TYPE("load", a, 0, LVAL_STR);
-
-  /* Parse File given by string name */
-  mpc_result_t r;
-  if (mpc_parse_contents(a->cell[0]->str, Mlisp, &r)) {
-
-    /* Read contents */
-    lval *expr = lval_read(r.output);
-    mpc_ast_delete(r.output);
-
-    /* Evaluate each Expression */
-    while (expr->count) {
-      lval *x = lval_eval(e, lval_pop(expr, 0));
-      /* If Evaluation leads to error print it */
-      if (x->type == LVAL_ERR) {
-        lval_println(x);
-      }
-      lval_del(x);
-    }
-
-    /* Delete expressions and arguments */
-    lval_del(expr);
-    lval_del(a);
-
-    /* Return empty list */
-    return lval_sexpr();
+lval *builtin_if(lenv *e, lval *a) { return lval_eval(e, lval_if_branch(a)); }
 
-  } else {
-    /* Get Parse Error as String */
-    char *err_msg = mpc_err_string(r.error);
-    mpc_err_delete(r.error);
+/* Stdlib functions written in C. They behave like their Lisp definitions in
+ * stdlib_lisp.mlisp, including the errors of the builtins those use. */
 
-    /* Create new error message using it */
-    lval *err = lval_err("Could not load Library %s", err_msg);
-    free(err_msg);
+/* Check the arguments 'a' of stdlib builtin 'op' taking 'n' arguments, the
+ * names of its formals in 'formals'. Returns NULL when all are given,
+ * otherwise the result of the call: an error, or like a lambda the function
+ * taking the rest. */
+lval *lstd_args(lenv *e, int op, lval *a, int n, char *formals) {
+  if (a->count > n) {
+    lval *err = lval_err("Function passed too many arguments. "
+                         "Got %i, Expected %i.",
+                         a->count, n);
     lval_del(a);
-
-    /* Cleanup and return error */
     return err;
   }
-}
+  if (a->count == n) {
+    return NULL;
+  }
 
-lval *builtin_print(lenv *e, lval *a) {
-#if __EMSCRIPTEN__
-  char *out = malloc(sizeof(char));
-  out[0] = '\0';
-  /* Concat each argument followed by a space */
-  for (int i = 0; i < a->count; i++) {
-    char *str = lval_to_str(a->cell[i]);
-    out = realloc(out, sizeof(char) * (strlen(out) + strlen(str) + 2));
-    strcat(out, str);
-    strcat(out, " ");
-    free(str);
+  /* Partially applied: (\ {rest} {<builtin> given... rest...}) */
+  lval *syms = lval_qexpr();
+  for (int i = 0; *formals; i++) {
+    int len = strcspn(formals, " ");
+    if (i >= a->count) {
+      char name[16];
+      snprintf(name, sizeof(name), "%.*s", len, formals);
+      lval_add(syms, lval_sym(name));
+    }
+    formals += len + (formals[len] == ' ');
   }
-  lval *x = lval_str(out);
-  free(out);
-  return x;
-#else
-  /* Print each argument followed by a space */
-  for (int i = 0; i < a->count; i++) {
-    lval_print(a->cell[i]);
-    putchar(' ');
+  lval *body = lval_add(lval_qexpr(), lval_fun(op));
+  while (a->count) {
+    lval_add(body, lval_pop(a, 0));
   }
-
-  /* Print a newline and delete arguments */
-  putchar('\n');
   lval_del(a);
-
-  return lval_sexpr();
-#endif
+  for (int i = 0; i < syms->count; i++) {
+    lval_add(body, lval_copy(syms->cell[i]));
+  }
+  return builtin_lambda(e, lval_add(lval_add(lval_sexpr(), syms), body));
 }
 
-lval *builtin_error(lenv *e, lval *a) {
-  LASSERT_NUM("error", a, 1);
-  LASSERT_TYPE("error", a, 0, LVAL_STR);
+/* Errors of 'head' and 'tail' for the list 'l' they cannot use */
+lval *lstd_head_err(lval *l) {
+  if (l->type != LVAL_QEXPR) {
+    return lval_err("Function 'head' passed incorrect type for argument 0. "
+                    "Got %s, Expected %s.",
+                    ltype_name(l->type), ltype_name(LVAL_QEXPR));
+  }
+  return lval_err("Function 'head' passed {}.");
+}
 
-  /* Construct Error from first argument */
-  lval *err = lval_err(a->cell[0]->str);
+lval *lstd_tail_err(lval *l) {
+  if (l->type != LVAL_QEXPR) {
+    return lval_err("Function 'tail' passed incorrect type. Got %s, "
+                    "Expected %s.",
+                    ltype_name(l->type), ltype_name(LVAL_QEXPR));
+  }
+  return lval_err("Function 'tail' passed {}!");
+}
 
-  /* Delete arguments and return */
-  lval_del(a);
-  return err;
+/* Error of comparing 'n' to a number with '<=' */
+lval *lstd_count_err(lval *n) {
+  return lval_err("Function '<=' passed incorrect type. Got %s, Expected %s.",
+                  ltype_name(n->type), ltype_name(LVAL_NUM));
 }
 
-lval *lval_call(lenv *e, lval *f, lval *a) {
+/* Element 'i' of 'l' as 'fst' gives it: evaluated */
+lval *lstd_value(lenv *e, lval *l, int i) {
+  return lval_eval(e, lval_copy(l->cell[i]));
+}
 
-  /* If Builtin then simply apply that */
+/* Call 'f' with the arguments 'a', leaving 'f' untouched */
+lval *lstd_apply(lenv *e, lval *f, lval *a) {
+  if (f->type != LVAL_FUN) {
+    lval_del(a);
+    return lval_err("S-Expression starts with incorrect type. "
+                    "Got %s, Expected %s.",
+                    ltype_name(f->type), ltype_name(LVAL_FUN));
+  }
   if (f->builtin) {
-    return f->builtin(e, a);
+    return lval_call(e, f, a);
   }
 
-  /* Record Argument Counts */
-  int given = a->count;
-  int total = f->formals->count;
+  /* Binding arguments consumes the formals of a lambda */
+  lval *g = lval_copy(f);
+  lval *r = lval_call(e, g, a);
+  lval_del(g);
+  return r;
+}
 
-  /* While arguments still remain to be processed */
-  while (a->count) {
+/* State of one pass over a lazy sequence */
+typedef struct literator {
+  lseq *seq;
+  long i;
+  lval *cur;
+  FILE *file;
+  struct literator *src;
+} literator;
+
+literator *liter_new(lseq *s) {
+  literator *it = malloc(sizeof(literator));
+  it->seq = s;
+  it->i = s->kind == LSEQ_RANGE ? s->start : 0;
+  it->cur = NULL;
+  it->file = NULL;
+  it->src = s->src ? liter_new(s->src) : NULL;
+  return it;
+}
 
-    /* If we've ran out of formal arguments to bind */
-    if (f->formals->count == 0) {
-      lval_del(a);
-      return lval_err("Function passed too many arguments. "
-                      "Got %i, Expected %i.",
-                      given, total);
-    }
+void liter_del(literator *it) {
+  if (it->src) {
+    liter_del(it->src);
+  }
+  if (it->cur) {
+    lval_del(it->cur);
+  }
+  if (it->file) {
+    fclose(it->file);
+  }
+  free(it);
+}
 
-    /* Pop the first symbol from the formals */
-    lval *sym = lval_pop(f->formals, 0);
+/* Next line of 'f' without its line break, or NULL at the end */
+lval *lseq_read_line(FILE *f) {
+  char buf[1024];
+  char *line = NULL;
+  size_t len = 0;
+  while (fgets(buf, sizeof(buf), f)) {
+    size_t n = strlen(buf);
+    line = realloc(line, len + n + 1);
+    memcpy(line + len, buf, n + 1);
+    len += n;
+    if (line[len - 1] == '\n') {
+      break;
+    }
+  }
+  if (!line) {
+    return NULL;
+  }
+  while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+    line[--len] = '\0';
+  }
+  lval *x = lval_str(line);
+  free(line);
+  return x;
+}
 
-    /* Special Case to deal with '&' */
-    if (strcmp(sym->sym, "&") == 0) {
+/* Next element of the pass 'it', NULL at the end, or an error */
+lval *liter_next(lenv *e, literator *it) {
+  lseq *s = it->seq;
+  lval *v;
+  switch (s->kind) {
+  case LSEQ_LIST:
+    /* Elements of a list are evaluated like 'fst' does */
+    return it->i < s->x->count ? lstd_value(e, s->x, it->i++) : NULL;
+
+  case LSEQ_RANGE:
+    return it->i < s->end ? lval_num(it->i++) : NULL;
+
+  case LSEQ_ITERATE:
+    if (it->cur) {
+      v = lstd_apply(e, s->f, lval_add(lval_sexpr(), it->cur));
+      it->cur = NULL;
+      if (v->type == LVAL_ERR) {
+        return v;
+      }
+      it->cur = v;
+    } else {
+      it->cur = lval_copy(s->x);
+    }
+    return lval_copy(it->cur);
 
-      /* Ensure '&' is followed by another symbol */
-      if (f->formals->count != 1) {
-        lval_del(a);
-        return lval_err("Function format invalid. "
-                        "Symbol '&' not followed by single symbol.");
+  case LSEQ_LINES:
+    /* The file is opened on the first element and closed after the last */
+    if (!it->file && it->i) {
+      return NULL;
+    }
+    if (!it->file) {
+      it->i = 1;
+      if (!(it->file = fopen(s->x->str, "r"))) {
+        return lval_err("Could not open file '%s'", s->x->str);
       }
+    }
+    if (!(v = lseq_read_line(it->file))) {
+      fclose(it->file);
+      it->file = NULL;
+    }
+    return v;
 
-      /* Next formal should be bound to remaining arguments */
-      lval *nsym = lval_pop(f->formals, 0);
-      lenv_put(f->env, nsym, builtin_list(e, a));
-      lval_del(sym);
-      lval_del(nsym);
-      break;
+  case LSEQ_MAP:
+    v = liter_next(e, it->src);
+    if (!v || v->type == LVAL_ERR) {
+      return v;
+    }
+    return lstd_apply(e, s->f, lval_add(lval_sexpr(), v));
+
+  case LSEQ_FILTER:
+    while ((v = liter_next(e, it->src)) && v->type != LVAL_ERR) {
+      lval *t = lstd_apply(e, s->f, lval_add(lval_sexpr(), lval_copy(v)));
+      if (t->type != LVAL_NUM && t->type != LVAL_ERR) {
+        lval *err = lval_err("Function '%s' passed incorrect type. Got %s, "
+                             "Expected %s.",
+                             "filter", ltype_name(t->type),
+                             ltype_name(LVAL_NUM));
+        lval_del(t);
+        t = err;
+      }
+      if (t->type == LVAL_ERR) {
+        lval_del(v);
+        return t;
+      }
+      int keep = t->num;
+      lval_del(t);
+      if (keep) {
+        return v;
+      }
+      lval_del(v);
+      if ((v = lval_guard())) {
+        return v;
+      }
     }
+    return v;
 
-    /* Pop the next argument from the list */
-    lval *val = lval_pop(a, 0);
+  case LSEQ_TAKE:
+    if (it->i >= s->end) {
+      return NULL;
+    }
+    it->i++;
+    return liter_next(e, it->src);
+
+  case LSEQ_DROP:
+    for (; it->i < s->end; it->i++) {
+      v = liter_next(e, it->src);
+      if (!v || v->type == LVAL_ERR) {
+        return v;
+      }
+      lval_del(v);
+    }
+    return liter_next(e, it->src);
+  }
+  return NULL;
+}
 
-    /* Bind a copy into the function's environment */
-    lenv_put(f->env, sym, val);
+/* Fold the elements of 's' with 'f' starting from 'z', which is taken,
+ * keeping only one element at a time */
+lval *lseq_foldl(lenv *e, lval *f, lval *z, lseq *s) {
+  literator *it = liter_new(s);
+  lval *v;
+  while (z->type != LVAL_ERR) {
+    if (!(v = lval_guard()) && !(v = liter_next(e, it))) {
+      break;
+    }
+    if (v->type == LVAL_ERR) {
+      lval_del(z);
+      z = v;
+      break;
+    }
+    z = lstd_apply(e, f, lval_add(lval_add(lval_sexpr(), z), v));
+  }
+  liter_del(it);
+  return z;
+}
 
-    /* Delete symbol and value */
-    lval_del(sym);
-    lval_del(val);
+/* Sequence 'kind' taking from 'l' when it is a sequence, otherwise NULL */
+lval *lseq_from(int kind, lval *f, lval *l, long n) {
+  if (l->type != LVAL_SEQ) {
+    return NULL;
   }
+  lseq *s = lseq_new(kind, f ? lval_copy(f) : NULL, NULL, l->seq);
+  s->end = n;
+  return lval_seq(s);
+}
 
-  /* Argument list is now bound so can be cleaned up */
-  lval_del(a);
+lval *builtin_seq(lenv *e, lval *a) {
+  LASSERT_NUM("seq", a, 1);
+  LASSERT_TYPE("seq", a, 0, LVAL_QEXPR);
 
-  /* If '&' remains in formal list bind to empty list */
-  if (f->formals->count > 0 && strcmp(f->formals->cell[0]->sym, "&") == 0) {
+  return lval_seq(lseq_new(LSEQ_LIST, NULL, lval_take(a, 0), NULL));
+}
 
-    /* Check to ensure that & is not passed invalidly. */
-    if (f->formals->count != 2) {
-      return lval_err("Function format invalid. "
-                      "Symbol '&' not followed by single symbol.");
-    }
+lval *builtin_seq_range(lenv *e, lval *a) {
+  LASSERT_NUM("seq-range", a, 2);
+  LASSERT_TYPE("seq-range", a, 0, LVAL_NUM);
+  LASSERT_TYPE("seq-range", a, 1, LVAL_NUM);
 
-    /* Pop and delete '&' symbol */
-    lval_del(lval_pop(f->formals, 0));
+  lseq *s = lseq_new(LSEQ_RANGE, NULL, NULL, NULL);
+  s->start = a->cell[0]->num;
+  s->end = a->cell[1]->num;
+  lval_del(a);
+  return lval_seq(s);
+}
 
-    /* Pop next symbol and create empty list */
-    lval *sym = lval_pop(f->formals, 0);
-    lval *val = lval_qexpr();
+lval *builtin_seq_iterate(lenv *e, lval *a) {
+  LASSERT_NUM("seq-iterate", a, 2);
+  LASSERT_TYPE("seq-iterate", a, 0, LVAL_FUN);
 
-    /* Bind to environment and delete */
-    lenv_put(f->env, sym, val);
-    lval_del(sym);
-    lval_del(val);
-  }
+  lval *f = lval_pop(a, 0);
+  return lval_seq(lseq_new(LSEQ_ITERATE, f, lval_take(a, 0), NULL));
+}
 
-  /* If all formals have been bound evaluate */
-  if (f->formals->count == 0) {
+lval *builtin_seq_lines(lenv *e, lval *a) {
+  LASSERT_NUM("seq-lines", a, 1);
+  LASSERT_TYPE("seq-lines", a, 0, LVAL_STR);
 
-    /* Set environment parent to evaluation environment */
-    f->env->par = e;
+  return lval_seq(lseq_new(LSEQ_LINES, NULL, lval_take(a, 0), NULL));
+}
 
-    /* Evaluate and return */
-    return builtin_eval(f->env, lval_add(lval_sexpr(), lval_copy(f->body)));
-  } else {
-    /* Otherwise return partially evaluated function */
-    return lval_copy(f);
+lval *builtin_seq_to_list(lenv *e, lval *a) {
+  LASSERT_NUM("seq->list", a, 1);
+  LASSERT_TYPE("seq->list", a, 0, LVAL_SEQ);
+
+  literator *it = liter_new(a->cell[0]->seq);
+  lval *r = lval_qexpr();
+  lval *v;
+  while ((v = lval_guard()) || (v = liter_next(e, it))) {
+    if (v->type == LVAL_ERR) {
+      lval_del(r);
+      r = v;
+      break;
+    }
+    lval_add(r, v);
   }
+  liter_del(it);
+  lval_del(a);
+  return r;
 }
 
-lval *lval_eval_sexpr(lenv *e, lval *v) {
-
-  /* Evaluate Children */
-  for (int i = 0; i < v->count; i++) {
-    v->cell[i] = lval_eval(e, v->cell[i]);
+/* Hash of 'v', equal for values lval_eq finds equal */
+unsigned long lval_hash(lval *v) {
+  unsigned long h = v->type + 1;
+  char *str = NULL;
+  switch (v->type) {
+  case LVAL_NUM:
+    return h * 31 + (unsigned long)v->num;
+  case LVAL_ERR:
+    str = v->err;
+    break;
+  case LVAL_SYM:
+    str = v->sym;
+    break;
+  case LVAL_STR:
+    str = v->str;
+    break;
+  case LVAL_FUN:
+    if (v->partial) {
+      return (h * 31 + lval_hash(v->partial->fn)) * 31 +
+             lval_hash(v->partial->args);
+    }
+    if (v->builtin) {
+      return h * 31 + v->op;
+    }
+    return (h * 31 + lval_hash(v->formals)) * 31 + lval_hash(v->body);
+  case LVAL_SEXPR:
+  case LVAL_QEXPR:
+    for (int i = 0; i < v->count; i++) {
+      h = h * 31 + lval_hash(v->cell[i]);
+    }
+    return h;
+  case LVAL_VEC:
+    for (int i = 0; i < v->vec->count; i++) {
+      h = h * 31 + lval_hash(v->vec->items[i]);
+    }
+    return h;
+  case LVAL_SEQ:
+    return h * 31 + (unsigned long)(size_t)v->seq;
+  }
+  for (; str && *str; str++) {
+    h = h * 31 + (unsigned char)*str;
+  }
+  return h;
+}
+
+lmemo *lmemo_new(lval *f, long max) {
+  lmemo *m = malloc(sizeof(lmemo));
+  m->refs = 1;
+  m->f = f;
+  m->max = max;
+  m->count = 0;
+  m->hits = 0;
+  m->misses = 0;
+  m->cap = 16;
+  m->buckets = calloc(m->cap, sizeof(lmemo_entry *));
+  m->newest = NULL;
+  m->oldest = NULL;
+  return m;
+}
+
+void lmemo_release(lmemo *m) {
+  if (--m->refs > 0) {
+    return;
+  }
+  lmemo_entry *en = m->newest;
+  while (en) {
+    lmemo_entry *older = en->older;
+    lval_del(en->key);
+    lval_del(en->val);
+    free(en);
+    en = older;
+  }
+  free(m->buckets);
+  lval_del(m->f);
+  free(m);
+}
+
+/* Link in the bucket holding the entry for 'key', or the end of it */
+lmemo_entry **lmemo_slot(lmemo *m, lval *key, unsigned long hash) {
+  lmemo_entry **slot = &m->buckets[hash % m->cap];
+  while (*slot && ((*slot)->hash != hash || !lval_eq((*slot)->key, key))) {
+    slot = &(*slot)->next;
+  }
+  return slot;
+}
+
+/* Take 'en' out of the order of use */
+void lmemo_unlink(lmemo *m, lmemo_entry *en) {
+  *(en->newer ? &en->newer->older : &m->newest) = en->older;
+  *(en->older ? &en->older->newer : &m->oldest) = en->newer;
+}
+
+/* Put 'en' first in the order of use */
+void lmemo_touch(lmemo *m, lmemo_entry *en) {
+  en->newer = NULL;
+  en->older = m->newest;
+  *(m->newest ? &m->newest->newer : &m->oldest) = en;
+  m->newest = en;
+}
+
+/* Remember 'val' for 'key', both taken */
+void lmemo_put(lmemo *m, lval *key, lval *val) {
+  unsigned long hash = lval_hash(key);
+  lmemo_entry **slot = lmemo_slot(m, key, hash);
+  if (*slot) {
+    lval_del(key);
+    lval_del((*slot)->val);
+    (*slot)->val = val;
+    return;
+  }
+
+  lmemo_entry *en = malloc(sizeof(lmemo_entry));
+  en->hash = hash;
+  en->key = key;
+  en->val = val;
+  en->next = NULL;
+  *slot = en;
+  lmemo_touch(m, en);
+  m->count++;
+
+  /* Drop the least recently used entry past the bound */
+  if (m->max && m->count > m->max) {
+    lmemo_entry *old = m->oldest;
+    lmemo_entry **link = lmemo_slot(m, old->key, old->hash);
+    *link = old->next;
+    lmemo_unlink(m, old);
+    lval_del(old->key);
+    lval_del(old->val);
+    free(old);
+    m->count--;
+  }
+
+  /* Keep buckets short by doubling them */
+  if (m->count > m->cap) {
+    int cap = m->cap * 2;
+    lmemo_entry **buckets = calloc(cap, sizeof(lmemo_entry *));
+    for (lmemo_entry *en = m->newest; en; en = en->older) {
+      en->next = buckets[en->hash % cap];
+      buckets[en->hash % cap] = en;
+    }
+    free(m->buckets);
+    m->buckets = buckets;
+    m->cap = cap;
+  }
+}
+
+/* Result remembered by 'm' for the arguments 'a', or NULL on a miss */
+lval *lmemo_get(lmemo *m, lval *a) {
+  lmemo_entry *en = *lmemo_slot(m, a, lval_hash(a));
+  if (!en) {
+    m->misses++;
+    return NULL;
+  }
+  m->hits++;
+  lmemo_unlink(m, en);
+  lmemo_touch(m, en);
+  return lval_copy(en->val);
+}
+
+/* Remember the result 'r' of a call with the arguments 'a', which are
+ * taken. Errors are not remembered, they may not happen again. */
+void lmemo_keep(lmemo *m, lval *a, lval *r) {
+  if (r->type == LVAL_ERR) {
+    lval_del(a);
+    return;
+  }
+  lmemo_put(m, a, lval_copy(r));
+}
+
+/* Call the function memoized by 'm' with the arguments 'a'. The VM enters
+ * compiled lambdas itself, see LBC_CALL. */
+lval *lmemo_call(lenv *e, lmemo *m, lval *a) {
+  lval *r = lmemo_get(m, a);
+  if (r) {
+    lval_del(a);
+    return r;
+  }
+  r = lstd_apply(e, m->f, lval_copy(a));
+  lmemo_keep(m, a, r);
+  return r;
+}
+
+lval *builtin_memo(lenv *e, lval *a) {
+  LASSERT(a, a->count == 1 || a->count == 2,
+          "Function 'memo' passed %i arguments, Expected 1 or 2.", a->count);
+  LASSERT_TYPE("memo", a, 0, LVAL_FUN);
+  long max = 0;
+  if (a->count == 2) {
+    LASSERT_TYPE("memo", a, 1, LVAL_NUM);
+    LASSERT(a, a->cell[1]->num > 0,
+            "Function 'memo' passed size %li, Expected a positive size.",
+            a->cell[1]->num);
+    max = a->cell[1]->num;
+  }
+
+  lval *f = lval_fun(LOP_MEMO);
+  f->memo = lmemo_new(lval_pop(a, 0), max);
+  lval_del(a);
+  return f;
+}
+
+/* Hits, misses and number of entries of a memoized function */
+lval *builtin_memo_stats(lenv *e, lval *a) {
+  LASSERT_NUM("memo-stats", a, 1);
+  LASSERT_TYPE("memo-stats", a, 0, LVAL_FUN);
+  lmemo *m = a->cell[0]->memo;
+  LASSERT(a, a->cell[0]->builtin && m,
+          "Function 'memo-stats' passed a function that is not memoized.");
+
+  lval *r = lval_qexpr();
+  lval_add(r, lval_num(m->hits));
+  lval_add(r, lval_num(m->misses));
+  lval_add(r, lval_num(m->count));
+  lval_del(a);
+  return r;
+}
+
+/* Number of arguments 'f' needs before it runs. 'rest' is set when it
+ * takes any number after them. */
+int lval_arity(lval *f, int *rest) {
+  if (f->partial) {
+    *rest = f->partial->rest;
+    return f->partial->need;
+  }
+  if (f->builtin) {
+    *rest = 1;
+    return 0;
+  }
+  int need = 0;
+  while (need < f->formals->count &&
+         strcmp(f->formals->cell[need]->sym, "&") != 0) {
+    need++;
+  }
+  *rest = need < f->formals->count;
+  return need;
+}
+
+/* The function 'fn' applied to the arguments 'a', both taken, without
+ * running it */
+lval *lval_partial(lval *fn, lval *a) {
+  lpartial *p = malloc(sizeof(lpartial));
+  p->refs = 1;
+  p->need = lval_arity(fn, &p->rest) - a->count;
+  if (p->need < 0) {
+    p->need = 0;
+  }
+  p->fn = fn;
+  p->args = a;
+
+  lval *f = lval_fun(LOP_PARTIAL);
+  f->partial = p;
+  return f;
+}
+
+void lpartial_release(lpartial *p) {
+  if (--p->refs > 0) {
+    return;
+  }
+  lval_del(p->fn);
+  lval_del(p->args);
+  free(p);
+}
+
+/* The lambda partial application 'f' stands for, with the number of its
+ * arguments given so far in 'given' */
+lval *lpartial_root(lval *f, int *given) {
+  *given = 0;
+  while (f->partial) {
+    *given += f->partial->args->count;
+    f = f->partial->fn;
+  }
+  return f;
+}
+
+/* Whether 'n' arguments are all that partial application 'f' needs */
+int lpartial_full(lval *f, int n) {
+  lpartial *p = f->partial;
+  return n > 0 && n >= p->need && (p->rest || n == p->need);
+}
+
+/* Replace partial application 'f', given all it needs by lpartial_full,
+ * with the function to call and return all of the arguments. 'a' is
+ * taken. */
+lval *lpartial_unfold(lval **f, lval *a) {
+  lval *g = *f;
+  while (g->partial) {
+    a = lval_join(lval_copy(g->partial->args), a);
+    g = g->partial->fn;
+  }
+  g = lval_callee(g, a->count);
+  lval_del(*f);
+  *f = g;
+  return a;
+}
+
+/* Call partial application 'f' with the arguments 'a' */
+lval *lpartial_call(lenv *e, lval *f, lval *a) {
+  lpartial *p = f->partial;
+  if (lpartial_full(f, a->count)) {
+    lval *g = lval_copy(f);
+    a = lpartial_unfold(&g, a);
+    lval *r = lval_call(e, g, a);
+    lval_del(g);
+    return r;
+  }
+
+  /* Without arguments it is returned as is, like lambdas */
+  if (a->count == 0) {
+    lval_del(a);
+    return lval_copy(f);
+  }
+  if (a->count < p->need) {
+    return lval_partial(lval_copy(f), a);
+  }
+  int given = a->count;
+  lval_del(a);
+  return lval_err("Function passed too many arguments. "
+                  "Got %i, Expected %i.",
+                  given, p->need);
+}
+
+lval *builtin_partial(lenv *e, lval *a) {
+  LASSERT(a, a->count >= 1,
+          "Function 'partial' passed %i arguments, Expected at least 1.",
+          a->count);
+  LASSERT_TYPE("partial", a, 0, LVAL_FUN);
+  int rest;
+  int need = lval_arity(a->cell[0], &rest);
+  LASSERT(a, rest || a->count - 1 <= need,
+          "Function 'partial' passed %i arguments for the function, "
+          "Expected at most %i.",
+          a->count - 1, need);
+
+  lval *f = lval_pop(a, 0);
+  if (a->count == 0) {
+    lval_del(a);
+    return f;
+  }
+  return lval_partial(f, a);
+}
+
+lval *builtin_len(lenv *e, lval *a) {
+  lval *r = lstd_args(e, LOP_LEN, a, 1, "l");
+  if (r) {
+    return r;
+  }
+  lval *l = a->cell[0];
+  r = l->type == LVAL_QEXPR ? lval_num(l->count) : lstd_tail_err(l);
+  lval_del(a);
+  return r;
+}
+
+lval *builtin_nth(lenv *e, lval *a) {
+  lval *r = lstd_args(e, LOP_NTH, a, 2, "n l");
+  if (r) {
+    return r;
+  }
+  lval *n = a->cell[0];
+  lval *l = a->cell[1];
+  if (n->type != LVAL_NUM) {
+    r = lstd_count_err(n);
+  } else if (l->type != LVAL_QEXPR) {
+    r = n->num > 0 ? lstd_tail_err(l) : lstd_head_err(l);
+  } else {
+    /* Tails are taken while 'n' is positive, then the head */
+    long i = n->num > 0 ? n->num : 0;
+    if (i > l->count) {
+      r = lstd_tail_err(l);
+    } else if (i == l->count) {
+      r = lstd_head_err(l);
+    } else {
+      r = lstd_value(e, l, i);
+    }
+  }
+  lval_del(a);
+  return r;
+}
+
+lval *builtin_last(lenv *e, lval *a) {
+  lval *r = lstd_args(e, LOP_LAST, a, 1, "l");
+  if (r) {
+    return r;
+  }
+  lval *l = a->cell[0];
+  if (l->type != LVAL_QEXPR) {
+    r = lstd_tail_err(l);
+  } else if (l->count == 0) {
+    r = lstd_head_err(l);
+  } else {
+    r = lstd_value(e, l, l->count - 1);
+  }
+  lval_del(a);
+  return r;
+}
+
+lval *builtin_take(lenv *e, lval *a) {
+  lval *r = lstd_args(e, LOP_TAKE, a, 2, "n l");
+  if (r) {
+    return r;
+  }
+  lval *n = a->cell[0];
+  lval *l = a->cell[1];
+  if (n->type != LVAL_NUM) {
+    r = lstd_count_err(n);
+  } else if (l->type == LVAL_SEQ) {
+    r = lseq_from(LSEQ_TAKE, NULL, l, n->num);
+  } else if (n->num <= 0) {
+    r = lval_qexpr();
+  } else if (l->type != LVAL_QEXPR || n->num > l->count) {
+    r = lstd_head_err(l);
+  } else {
+    r = lval_qexpr();
+    for (int i = 0; i < n->num; i++) {
+      lval_add(r, lval_copy(l->cell[i]));
+    }
+  }
+  lval_del(a);
+  return r;
+}
+
+lval *builtin_drop(lenv *e, lval *a) {
+  lval *r = lstd_args(e, LOP_DROP, a, 2, "n l");
+  if (r) {
+    return r;
+  }
+  lval *n = a->cell[0];
+  lval *l = a->cell[1];
+  if (n->type != LVAL_NUM) {
+    r = lstd_count_err(n);
+  } else if (l->type == LVAL_SEQ) {
+    r = lseq_from(LSEQ_DROP, NULL, l, n->num);
+  } else if (n->num <= 0) {
+    r = lval_take(a, 1);
+    a = NULL;
+  } else if (l->type != LVAL_QEXPR || n->num > l->count) {
+    r = lstd_tail_err(l);
+  } else {
+    r = lval_qexpr();
+    for (int i = n->num; i < l->count; i++) {
+      lval_add(r, lval_copy(l->cell[i]));
+    }
+  }
+  if (a) {
+    lval_del(a);
+  }
+  return r;
+}
+
+lval *builtin_elem(lenv *e, lval *a) {
+  lval *r = lstd_args(e, LOP_ELEM, a, 2, "x l");
+  if (r) {
+    return r;
+  }
+  lval *x = a->cell[0];
+  lval *l = a->cell[1];
+  if (l->type != LVAL_QEXPR) {
+    r = lstd_head_err(l);
+  }
+  for (int i = 0; !r && i < l->count; i++) {
+    lval *v = lstd_value(e, l, i);
+    if (v->type == LVAL_ERR) {
+      r = v;
+    } else if (lval_eq(x, v)) {
+      lval_del(v);
+      r = lval_num(1);
+    } else {
+      lval_del(v);
+    }
+  }
+  lval_del(a);
+  return r ? r : lval_num(0);
+}
+
+lval *builtin_map(lenv *e, lval *a) {
+  lval *r = lstd_args(e, LOP_MAP, a, 2, "f l");
+  if (r) {
+    return r;
+  }
+  lval *f = a->cell[0];
+  lval *l = a->cell[1];
+  if ((r = lseq_from(LSEQ_MAP, f, l, 0)) || l->type != LVAL_QEXPR) {
+    r = r ? r : lstd_head_err(l);
+    lval_del(a);
+    return r;
+  }
+
+  r = lval_qexpr();
+  for (int i = 0; i < l->count; i++) {
+    lval *v = lstd_value(e, l, i);
+    if (v->type != LVAL_ERR) {
+      v = lstd_apply(e, f, lval_add(lval_sexpr(), v));
+    }
+    if (v->type == LVAL_ERR) {
+      lval_del(r);
+      r = v;
+      break;
+    }
+    lval_add(r, v);
+  }
+  lval_del(a);
+  return r;
+}
+
+lval *builtin_filter(lenv *e, lval *a) {
+  lval *r = lstd_args(e, LOP_FILTER, a, 2, "f l");
+  if (r) {
+    return r;
+  }
+  lval *f = a->cell[0];
+  lval *l = a->cell[1];
+  if ((r = lseq_from(LSEQ_FILTER, f, l, 0)) || l->type != LVAL_QEXPR) {
+    r = r ? r : lstd_head_err(l);
+    lval_del(a);
+    return r;
+  }
+
+  /* Elements kept are the ones given, not their values */
+  r = lval_qexpr();
+  for (int i = 0; i < l->count; i++) {
+    lval *v = lstd_value(e, l, i);
+    if (v->type != LVAL_ERR) {
+      v = lstd_apply(e, f, lval_add(lval_sexpr(), v));
+    }
+    if (v->type != LVAL_ERR && v->type != LVAL_NUM) {
+      lval *err = lval_err("Function '%s' passed incorrect type. Got %s, "
+                           "Expected %s.",
+                           "if", ltype_name(v->type), ltype_name(LVAL_NUM));
+      lval_del(v);
+      v = err;
+    }
+    if (v->type == LVAL_ERR) {
+      lval_del(r);
+      r = v;
+      break;
+    }
+    if (v->num) {
+      lval_add(r, lval_copy(l->cell[i]));
+    }
+    lval_del(v);
+  }
+  lval_del(a);
+  return r;
+}
+
+/* Fold 'l' with 'f' starting from 'z', all three taken */
+lval *lstd_foldl(lenv *e, lval *f, lval *z, lval *l) {
+  if (l->type == LVAL_SEQ) {
+    return lseq_foldl(e, f, z, l->seq);
+  }
+  if (l->type != LVAL_QEXPR) {
+    lval_del(z);
+    return lstd_head_err(l);
+  }
+  for (int i = 0; i < l->count; i++) {
+    lval *v = lstd_value(e, l, i);
+    if (v->type == LVAL_ERR) {
+      lval_del(z);
+      return v;
+    }
+    z = lstd_apply(e, f, lval_add(lval_add(lval_sexpr(), z), v));
+    if (z->type == LVAL_ERR) {
+      return z;
+    }
+  }
+  return z;
+}
+
+lval *builtin_foldl(lenv *e, lval *a) {
+  lval *r = lstd_args(e, LOP_FOLDL, a, 3, "f z l");
+  if (r) {
+    return r;
+  }
+  lval *z = lval_pop(a, 1);
+  r = lstd_foldl(e, a->cell[0], z, a->cell[1]);
+  lval_del(a);
+  return r;
+}
+
+/* Fold 'l' with the function bound to 'sym', starting from 'z'. When that
+ * is the builtin 'op' Numbers are accumulated without calls. */
+lval *lstd_reduce(lenv *e, lval *a, int op, char *sym, long z) {
+  lval *r = lstd_args(e, op == LOP_ADD ? LOP_SUM : LOP_PROD, a, 1, "l");
+  if (r) {
+    return r;
+  }
+  lval *l = a->cell[0];
+  lval *k = lval_sym(sym);
+  lval *f = lenv_get(e, k);
+  lval_del(k);
+  if (f->type == LVAL_ERR) {
+    lval_del(a);
+    return f;
+  }
+
+  if (f->type == LVAL_FUN && f->builtin && f->op == op &&
+      l->type == LVAL_QEXPR) {
+    int i = 0;
+    for (; i < l->count && l->cell[i]->type == LVAL_NUM; i++) {
+      z = op == LOP_ADD ? z + l->cell[i]->num : z * l->cell[i]->num;
+    }
+    /* Elements other than Numbers fold like with any other function */
+    if (i < l->count) {
+      lval *rest = lval_qexpr();
+      for (int j = i; j < l->count; j++) {
+        lval_add(rest, lval_copy(l->cell[j]));
+      }
+      r = lstd_foldl(e, f, lval_num(z), rest);
+      lval_del(rest);
+    } else {
+      r = lval_num(z);
+    }
+  } else {
+    r = lstd_foldl(e, f, lval_num(z), l);
+  }
+  lval_del(f);
+  lval_del(a);
+  return r;
+}
+
+lval *builtin_sum(lenv *e, lval *a) {
+  return lstd_reduce(e, a, LOP_ADD, "+", 0);
+}
+
+lval *builtin_prod(lenv *e, lval *a) {
+  return lstd_reduce(e, a, LOP_MUL, "*", 1);
+}
+
+/* Copy of Q-Expression 'q' to evaluate as code */
+lval *lval_code(lval *q) {
+  lval *x = lval_copy(q);
+  x->type = LVAL_SEXPR;
+  return x;
+}
+
+/* Result of a 'while' loop whose condition gave 'c', which is taken, or
+ * NULL when the loop goes on */
+lval *lwhile_end(lval *c) {
+  if (c->type == LVAL_NUM) {
+    int go = c->num;
+    lval_del(c);
+    return go ? NULL : lval_sexpr();
+  }
+  if (c->type == LVAL_ERR) {
+    return c;
+  }
+  lval *err = lval_err("Function '%s' passed incorrect type. Got %s, "
+                       "Expected %s.",
+                       "while", ltype_name(c->type), ltype_name(LVAL_NUM));
+  lval_del(c);
+  return err;
+}
+
+lval *builtin_while(lenv *e, lval *a) {
+  LASSERT_NUM("while", a, 2);
+  LASSERT_TYPE("while", a, 0, LVAL_QEXPR);
+  LASSERT_TYPE("while", a, 1, LVAL_QEXPR);
+
+  lval *x;
+  while (!(x = lval_guard()) &&
+         !(x = lwhile_end(lval_eval(e, lval_code(a->cell[0]))))) {
+    /* The body is evaluated for its effects, an error ends the loop */
+    lval *r = lval_eval(e, lval_code(a->cell[1]));
+    if (r->type == LVAL_ERR) {
+      x = r;
+      break;
+    }
+    lval_del(r);
+  }
+
+  lval_del(a);
+  return x;
+}
+
+/* Value bound in iteration 'i' of 'dotimes' over count 'l' or 'for-each'
+ * over list 'l', NULL once the loop is done, or an error */
+lval *lloop_value(lenv *e, int op, lval *l, long i) {
+  int type = op == LOP_DOTIMES ? LVAL_NUM : LVAL_QEXPR;
+  if (l->type == LVAL_ERR) {
+    return lval_copy(l);
+  }
+  if (l->type != type) {
+    return lval_err("Function '%s' passed incorrect type. Got %s, "
+                    "Expected %s.",
+                    lbuiltins[op].name, ltype_name(l->type),
+                    ltype_name(type));
+  }
+  if (i >= (op == LOP_DOTIMES ? l->num : l->count)) {
+    return NULL;
+  }
+  return op == LOP_DOTIMES ? lval_num(i) : lstd_value(e, l, i);
+}
+
+/* The loop symbol 'sym' is bound in 'e' itself while the loop runs. What
+ * it was bound to there before, or NULL, is given back when it ends. */
+lval *lloop_save(lenv *e, char *sym) {
+  lval **slot = lenv_slot(e, sym);
+  return slot ? lval_copy(*slot) : NULL;
+}
+
+void lloop_restore(lenv *e, char *sym, lval *saved) {
+  if (saved) {
+    lenv_bind(e, sym, saved);
+  } else {
+    lenv_unbind(e, sym);
+  }
+}
+
+/* Evaluate a body with a symbol bound in turn to the numbers below a count
+ * for 'dotimes', or to the elements of a list for 'for-each' */
+lval *builtin_loop(lenv *e, lval *a, int op) {
+  char *func = lbuiltins[op].name;
+  LASSERT_NUM(func, a, 3);
+  LASSERT_TYPE(func, a, 0, LVAL_QEXPR);
+  LASSERT(a,
+          a->cell[0]->count == 1 && a->cell[0]->cell[0]->type == LVAL_SYM,
+          "Function '%s' must bind a single symbol.", func);
+  LASSERT_TYPE(func, a, 2, LVAL_QEXPR);
+
+  char *sym = a->cell[0]->cell[0]->sym;
+  lfold_forget(sym);
+
+  lval *saved = lloop_save(e, sym);
+  lval *x;
+  for (long i = 0; !(x = lval_guard()); i++) {
+    lval *v = lloop_value(e, op, a->cell[1], i);
+    if (!v || v->type == LVAL_ERR) {
+      x = v ? v : lval_sexpr();
+      break;
+    }
+    lenv_bind(e, sym, v);
+
+    lval *r = lval_eval(e, lval_code(a->cell[2]));
+    if (r->type == LVAL_ERR) {
+      x = r;
+      break;
+    }
+    lval_del(r);
+  }
+  lloop_restore(e, sym, saved);
+
+  lval_del(a);
+  return x;
+}
+
+lval *builtin_dotimes(lenv *e, lval *a) {
+  return builtin_loop(e, a, LOP_DOTIMES);
+}
+
+lval *builtin_for_each(lenv *e, lval *a) {
+  return builtin_loop(e, a, LOP_FOR_EACH);
+}
+
+/* Parse a file and evaluate every expression in it inside 'e' */
+lval *lenv_load(lenv *e, char *filename) {
+  /* Parse File given by string name */
+  lval *expr = lread_file(filename);
+  if (expr->type != LVAL_ERR) {
+
+    /* Evaluate each Expression */
+    while (expr->count) {
+      if (lfold_dump && globalEnv) {
+        lfold_print(expr->cell[0]);
+      }
+      lval *x = lval_eval(e, lval_pop(expr, 0));
+      /* If Evaluation leads to error print it */
+      if (x->type == LVAL_ERR) {
+        lval_println(x);
+      }
+      lval_del(x);
+    }
+
+    /* Delete expressions and return empty list */
+    lval_del(expr);
+    return lval_sexpr();
+
+  } else {
+    /* Create new error message using the parse error */
+    lval *err = lval_err("Could not load Library %s", expr->err);
+    lval_del(expr);
+    return err;
+  }
+}
+
+lval *builtin_load(lenv *e, lval *a) {
+  LASSERT_NUM("load", a, 1);
+  LASSERT_TYPE("load", a, 0, LVAL_STR);
+
+  lval *x = lenv_load(e, a->cell[0]->str);
+  lval_del(a);
+  return x;
+}
+
+/* A loaded module: its own namespace plus the symbols it exports */
+typedef struct {
+  char *path;
+  lenv *env;
+  /* Q-Expression of exported symbols, or NULL to export everything */
+  lval *exports;
+} lmodule;
+
+lmodule *modules = NULL;
+int modules_count = 0;
+
+lmodule *lmodule_find(char *path) {
+  for (int i = 0; i < modules_count; i++) {
+    if (strcmp(modules[i].path, path) == 0) {
+      return &modules[i];
+    }
+  }
+  return NULL;
+}
+
+/* Load the module at 'path' once, returning the cached one afterwards */
+lval *lmodule_load(lenv *e, char *path, lmodule **out) {
+  lmodule *m = lmodule_find(path);
+  if (m) {
+    *out = m;
+    return NULL;
+  }
+
+  /* Module namespaces sit directly below the root environment */
+  while (e->par) {
+    e = e->par;
+  }
+  lenv *ns = lenv_new();
+  ns->par = e;
+  ns->ns = ns;
+
+  /* Register before evaluating so cyclic imports see the namespace */
+  modules_count++;
+  modules = realloc(modules, sizeof(lmodule) * modules_count);
+  m = &modules[modules_count - 1];
+  m->path = malloc(strlen(path) + 1);
+  strcpy(m->path, path);
+  m->env = ns;
+  m->exports = NULL;
+
+  lval *x = lenv_load(ns, path);
+  if (x->type == LVAL_ERR) {
+    /* Forget modules that could not be parsed */
+    m = lmodule_find(path);
+    free(m->path);
+    lenv_del(m->env);
+    *m = modules[--modules_count];
+    return x;
+  }
+  lval_del(x);
+
+  *out = lmodule_find(path);
+  return NULL;
+}
+
+/* Namespace holding the binding of 'sym' that module namespace 'ns'
+ * defines or imports */
+lenv *lmodule_owner(lenv *ns, char *sym) {
+  lval **slot;
+  while ((slot = lenv_slot(ns, sym)) && (*slot)->type == LVAL_FWD) {
+    ns = (*slot)->env;
+  }
+  return ns;
+}
+
+/* Bind 'sym' in 'e' to the binding of module namespace 'ns', which must
+ * have one. Root and module namespaces forward lookups to the namespace
+ * defining it, so they see what the module binds it to later, and never
+ * forward to themselves. The environment of a function gets a copy, its
+ * bindings are read by slot. */
+void lmodule_bind(lenv *e, lenv *ns, char *sym) {
+  ns = lmodule_owner(ns, sym);
+  if (ns == e) {
+    return;
+  }
+  if (!e->par || e->ns == e) {
+    lenv_bind(e, sym, lval_fwd(ns));
+  } else {
+    lenv_bind(e, sym, lval_copy(lenv_find(ns, sym)));
+  }
+}
+
+lval *builtin_import(lenv *e, lval *a) {
+  LASSERT(a, a->count == 1 || a->count == 2,
+          "Function 'import' passed incorrect number of arguments. Got %i, "
+          "Expected %i or %i.",
+          a->count, 1, 2);
+  LASSERT_TYPE("import", a, 0, LVAL_STR);
+  if (a->count == 2) {
+    LASSERT_TYPE("import", a, 1, LVAL_QEXPR);
+  }
+
+  lmodule *m;
+  lval *err = lmodule_load(e, a->cell[0]->str, &m);
+  if (err) {
+    lval_del(a);
+    return err;
+  }
+
+  /* Import the requested symbols, or every export */
+  lval *syms = a->count == 2 ? a->cell[1] : m->exports;
+  if (syms) {
+    for (int i = 0; i < syms->count; i++) {
+      LASSERT(a, syms->cell[i]->type == LVAL_SYM,
+              "Function 'import' cannot import non-symbol. "
+              "Got %s, Expected %s.",
+              ltype_name(syms->cell[i]->type), ltype_name(LVAL_SYM));
+      LASSERT(a, !m->exports || lval_contains(m->exports, syms->cell[i]),
+              "Module '%s' does not export '%s'.", m->path,
+              syms->cell[i]->sym);
+      lval **slot = lenv_follow(lenv_slot(m->env, syms->cell[i]->sym),
+                                syms->cell[i]->sym);
+      LASSERT(a, slot, "Module '%s' does not define '%s'.", m->path,
+              syms->cell[i]->sym);
+      lmodule_bind(e, m->env, syms->cell[i]->sym);
+    }
+  } else {
+    for (int i = 0; i < m->env->count; i++) {
+      if (lenv_follow(&m->env->vals[i], m->env->syms[i])) {
+        lmodule_bind(e, m->env, m->env->syms[i]);
+      }
+    }
+  }
+
+  lval_del(a);
+  return lval_sexpr();
+}
+
+lval *builtin_export(lenv *e, lval *a) {
+  LASSERT_NUM("export", a, 1);
+  LASSERT_TYPE("export", a, 0, LVAL_QEXPR);
+  for (int i = 0; i < a->cell[0]->count; i++) {
+    LASSERT(a, a->cell[0]->cell[i]->type == LVAL_SYM,
+            "Function 'export' cannot export non-symbol. "
+            "Got %s, Expected %s.",
+            ltype_name(a->cell[0]->cell[i]->type), ltype_name(LVAL_SYM));
+  }
+
+  /* Find the module currently being evaluated */
+  lenv *ns = lenv_ns(e);
+  lmodule *m = NULL;
+  for (int i = 0; ns && i < modules_count; i++) {
+    if (modules[i].env == ns) {
+      m = &modules[i];
+    }
+  }
+  LASSERT(a, m, "Function 'export' used outside of a module.");
+
+  /* Repeated exports accumulate */
+  lval *syms = lval_take(a, 0);
+  m->exports = m->exports ? lval_join(m->exports, syms) : syms;
+  return lval_sexpr();
+}
+
+/* Heap images: --save-image writes the bindings of the root environment and
+ * of every loaded module to a file, which --load-image maps into memory and
+ * rebuilds the values from without parsing or evaluating anything. Values
+ * own their storage, so they are rebuilt rather than pointed into the map.
+ * Vectors, sequences, memos and partial applications are written once and
+ * referred to by number afterwards, so the values sharing them still do. */
+
+#define LIMG_MAGIC "mlisp image 1\n"
+
+typedef struct {
+  FILE *out;
+  /* Numbers of the shared storage written so far, by address */
+  void **keys;
+  int *ids;
+  int cap;
+  int count;
+} limg_out;
+
+void limg_put(limg_out *w, unsigned long long n, int bytes) {
+  for (int i = 0; i < bytes; i++) {
+    fputc((n >> (8 * i)) & 0xff, w->out);
+  }
+}
+
+/* Strings keep their terminator so they can be used in place when read */
+void limg_put_str(limg_out *w, char *s) {
+  size_t n = strlen(s) + 1;
+  limg_put(w, n, 4);
+  fwrite(s, 1, n, w->out);
+}
+
+int limg_slot(void **keys, int cap, void *p) {
+  int i = ((size_t)p >> 4) & (cap - 1);
+  while (keys[i] && keys[i] != p) {
+    i = (i + 1) & (cap - 1);
+  }
+  return i;
+}
+
+/* Write the number of shared storage 'p', returning whether it is new
+ * and its contents must follow */
+int limg_put_shared(limg_out *w, void *p) {
+  if (2 * (w->count + 1) > w->cap) {
+    int cap = w->cap ? w->cap * 2 : 64;
+    void **keys = calloc(cap, sizeof(void *));
+    int *ids = malloc(sizeof(int) * cap);
+    for (int i = 0; i < w->cap; i++) {
+      if (w->keys[i]) {
+        int j = limg_slot(keys, cap, w->keys[i]);
+        keys[j] = w->keys[i];
+        ids[j] = w->ids[i];
+      }
+    }
+    free(w->keys);
+    free(w->ids);
+    w->keys = keys;
+    w->ids = ids;
+    w->cap = cap;
+  }
+
+  int i = limg_slot(w->keys, w->cap, p);
+  if (w->keys[i]) {
+    limg_put(w, w->ids[i], 4);
+    return 0;
+  }
+  w->keys[i] = p;
+  w->ids[i] = w->count++;
+  limg_put(w, w->ids[i], 4);
+  return 1;
+}
+
+void limg_put_val(limg_out *w, lval *v);
+
+void limg_put_seq(limg_out *w, lseq *s) {
+  if (!limg_put_shared(w, s)) {
+    return;
+  }
+  limg_put(w, s->kind, 1);
+  limg_put(w, s->start, 8);
+  limg_put(w, s->end, 8);
+  limg_put(w, s->f != NULL, 1);
+  if (s->f) {
+    limg_put_val(w, s->f);
+  }
+  limg_put(w, s->x != NULL, 1);
+  if (s->x) {
+    limg_put_val(w, s->x);
+  }
+  limg_put(w, s->src != NULL, 1);
+  if (s->src) {
+    limg_put_seq(w, s->src);
+  }
+}
+
+/* Bindings of 'e' */
+void limg_put_env(limg_out *w, lenv *e) {
+  limg_put(w, e->count, 4);
+  for (int i = 0; i < e->count; i++) {
+    limg_put_str(w, e->syms[i]);
+    limg_put_val(w, e->vals[i]);
+  }
+}
+
+void limg_put_fun(limg_out *w, lval *v) {
+  if (v->memo) {
+    fputc('m', w->out);
+    if (limg_put_shared(w, v->memo)) {
+      limg_put(w, v->memo->max, 8);
+      limg_put_val(w, v->memo->f);
+    }
+  } else if (v->partial) {
+    fputc('p', w->out);
+    if (limg_put_shared(w, v->partial)) {
+      limg_put(w, v->partial->need, 4);
+      limg_put(w, v->partial->rest, 1);
+      limg_put_val(w, v->partial->fn);
+      limg_put_val(w, v->partial->args);
+    }
+  } else if (v->builtin) {
+    fputc('b', w->out);
+    limg_put_str(w, lbuiltins[v->op].name);
+  } else {
+    /* Module whose namespace the lambda sees, counted from 1 */
+    int ns = 0;
+    for (int i = 0; v->env->ns && i < modules_count; i++) {
+      if (modules[i].env == v->env->ns) {
+        ns = i + 1;
+      }
+    }
+    fputc('f', w->out);
+    limg_put(w, ns, 4);
+    limg_put_val(w, v->formals);
+    limg_put_val(w, v->body);
+    limg_put_env(w, v->env);
+  }
+}
+
+void limg_put_val(limg_out *w, lval *v) {
+  switch (v->type) {
+  case LVAL_NUM:
+    fputc('n', w->out);
+    limg_put(w, v->num, 8);
+    break;
+  case LVAL_ERR:
+    fputc('e', w->out);
+    limg_put_str(w, v->err);
+    break;
+  case LVAL_SYM:
+    fputc('y', w->out);
+    limg_put_str(w, v->sym);
+    break;
+  case LVAL_STR:
+    fputc('s', w->out);
+    limg_put_str(w, v->str);
+    break;
+  case LVAL_SEXPR:
+  case LVAL_QEXPR:
+    fputc(v->type == LVAL_SEXPR ? '(' : '{', w->out);
+    limg_put(w, v->count, 4);
+    for (int i = 0; i < v->count; i++) {
+      limg_put_val(w, v->cell[i]);
+    }
+    break;
+  case LVAL_VEC:
+    fputc('v', w->out);
+    if (limg_put_shared(w, v->vec)) {
+      limg_put(w, v->vec->count, 4);
+      for (int i = 0; i < v->vec->count; i++) {
+        limg_put_val(w, v->vec->items[i]);
+      }
+    }
+    break;
+  case LVAL_SEQ:
+    fputc('q', w->out);
+    limg_put_seq(w, v->seq);
+    break;
+  case LVAL_FUN:
+    limg_put_fun(w, v);
+    break;
+  case LVAL_FWD:
+    /* Module forwarded to, counted from 1 */
+    fputc('i', w->out);
+    for (int i = 0; i < modules_count; i++) {
+      if (modules[i].env == v->env) {
+        limg_put(w, i + 1, 4);
+      }
+    }
+    break;
+  }
+}
+
+/* Write the image of 'e' and of the loaded modules to 'path' */
+lval *limg_save(lenv *e, char *path) {
+  FILE *out = fopen(path, "wb");
+  if (!out) {
+    return lval_err("Could not write image %s", path);
+  }
+  limg_out w = {out, NULL, NULL, 0, 0};
+  fputs(LIMG_MAGIC, out);
+  limg_put(&w, lfold_intact | lform_intact << 1, 1);
+
+  /* Modules come first so lambdas can refer to their namespaces */
+  limg_put(&w, modules_count, 4);
+  for (int i = 0; i < modules_count; i++) {
+    limg_put_str(&w, modules[i].path);
+    limg_put(&w, modules[i].exports != NULL, 1);
+    if (modules[i].exports) {
+      limg_put_val(&w, modules[i].exports);
+    }
+  }
+  for (int i = 0; i < modules_count; i++) {
+    limg_put_env(&w, modules[i].env);
+  }
+  limg_put_env(&w, e);
+
+  free(w.keys);
+  free(w.ids);
+  int err = ferror(out);
+  if (fclose(out) != 0 || err) {
+    return lval_err("Could not write image %s", path);
+  }
+  return lval_sexpr();
+}
+
+typedef struct {
+  unsigned char *p;
+  unsigned char *end;
+  /* Set once the image turns out to be malformed */
+  int bad;
+  /* Shared storage read so far by number, with the tag it was read with */
+  void **objs;
+  char *tags;
+  int count;
+  /* Root environment, and the first module of the image */
+  lenv *root;
+  int modules;
+} limg_in;
+
+unsigned long long limg_get(limg_in *r, int bytes) {
+  if (r->end - r->p < bytes) {
+    r->bad = 1;
+    return 0;
+  }
+  unsigned long long n = 0;
+  for (int i = 0; i < bytes; i++) {
+    n |= (unsigned long long)r->p[i] << (8 * i);
+  }
+  r->p += bytes;
+  return n;
+}
+
+/* A string in place inside the image */
+char *limg_get_str(limg_in *r) {
+  unsigned long long n = limg_get(r, 4);
+  if (n == 0 || (unsigned long long)(r->end - r->p) < n || r->p[n - 1]) {
+    r->bad = 1;
+    return "";
+  }
+  char *s = (char *)r->p;
+  r->p += n;
+  return s;
+}
+
+/* A count of items following, each of which takes at least a byte */
+int limg_get_count(limg_in *r) {
+  unsigned long long n = limg_get(r, 4);
+  if (n > (unsigned long long)(r->end - r->p)) {
+    r->bad = 1;
+    return 0;
+  }
+  return n;
+}
+
+/* Read the number of shared storage of kind 'tag', returning the storage
+ * if it was read before, or NULL and setting 'fresh' if its contents follow */
+void *limg_get_shared(limg_in *r, char tag, int *fresh) {
+  unsigned long long id = limg_get(r, 4);
+  *fresh = 0;
+  if (id < (unsigned long long)r->count && !r->bad && r->tags[id] == tag) {
+    return r->objs[id];
+  }
+  if (id == (unsigned long long)r->count && !r->bad) {
+    *fresh = 1;
+  } else {
+    r->bad = 1;
+  }
+  return NULL;
+}
+
+/* Number the shared storage 'p' before reading its contents, which may
+ * refer back to it */
+void limg_keep(limg_in *r, char tag, void *p) {
+  r->objs = realloc(r->objs, sizeof(void *) * (r->count + 1));
+  r->tags = realloc(r->tags, r->count + 1);
+  r->objs[r->count] = p;
+  r->tags[r->count++] = tag;
+}
+
+lval *limg_get_val(limg_in *r);
+
+lseq *limg_get_seq(limg_in *r) {
+  int fresh;
+  lseq *s = limg_get_shared(r, 'q', &fresh);
+  if (s) {
+    s->refs++;
+    return s;
+  }
+  if (!fresh) {
+    return NULL;
+  }
+  int kind = limg_get(r, 1);
+  if (kind > LSEQ_DROP) {
+    r->bad = 1;
+    return NULL;
+  }
+  s = lseq_new(kind, NULL, NULL, NULL);
+  limg_keep(r, 'q', s);
+  s->start = (long)limg_get(r, 8);
+  s->end = (long)limg_get(r, 8);
+  if (limg_get(r, 1)) {
+    s->f = limg_get_val(r);
+  }
+  if (limg_get(r, 1)) {
+    s->x = limg_get_val(r);
+  }
+  if (limg_get(r, 1)) {
+    s->src = limg_get_seq(r);
+  }
+  return s;
+}
+
+/* Read bindings into 'e' */
+void limg_get_env(limg_in *r, lenv *e) {
+  int n = limg_get_count(r);
+  for (int i = 0; i < n && !r->bad; i++) {
+    lval *k = lval_sym(limg_get_str(r));
+    lval *v = limg_get_val(r);
+    lenv_put(e, k, v);
+    lval_del(k);
+    lval_del(v);
+  }
+}
+
+lval *limg_get_lambda(limg_in *r) {
+  unsigned long long ns = limg_get(r, 4);
+  if (ns > (unsigned long long)(modules_count - r->modules)) {
+    r->bad = 1;
+    return lval_sexpr();
+  }
+  lval *formals = limg_get_val(r);
+  lval *body = limg_get_val(r);
+  int ok = formals->type == LVAL_QEXPR && body->type == LVAL_QEXPR;
+  for (int i = 0; ok && i < formals->count; i++) {
+    ok = formals->cell[i]->type == LVAL_SYM;
+  }
+  if (!ok || r->bad) {
+    r->bad = 1;
+    lval_del(formals);
+    lval_del(body);
+    return lval_sexpr();
+  }
+
+  lenv *e = ns ? modules[r->modules + ns - 1].env : r->root;
+  lval *f = lenv_lambda(e, formals, body);
+  limg_get_env(r, f->env);
+  return f;
+}
+
+lval *limg_get_val(limg_in *r) {
+  int fresh;
+  switch (limg_get(r, 1)) {
+  case 'n':
+    return lval_num((long)limg_get(r, 8));
+  case 'e':
+    return lval_err("%s", limg_get_str(r));
+  case 'y':
+    return lval_sym(limg_get_str(r));
+  case 's':
+    return lval_str(limg_get_str(r));
+  case '(':
+  case '{': {
+    lval *x = r->p[-1] == '(' ? lval_sexpr() : lval_qexpr();
+    int n = limg_get_count(r);
+    for (int i = 0; i < n && !r->bad; i++) {
+      lval_add(x, limg_get_val(r));
+    }
+    return x;
+  }
+  case 'v': {
+    lvec *v = limg_get_shared(r, 'v', &fresh);
+    if (v) {
+      v->refs++;
+      return lval_vec(v);
+    }
+    if (!fresh) {
+      return lval_sexpr();
+    }
+    int n = limg_get_count(r);
+    v = lvec_new(n);
+    limg_keep(r, 'v', v);
+    for (int i = 0; i < n && !r->bad; i++) {
+      lvec_push(v, limg_get_val(r));
+    }
+    return lval_vec(v);
+  }
+  case 'q': {
+    lseq *s = limg_get_seq(r);
+    return s ? lval_seq(s) : lval_sexpr();
+  }
+  case 'i': {
+    unsigned long long ns = limg_get(r, 4);
+    if (ns == 0 || ns > (unsigned long long)(modules_count - r->modules)) {
+      r->bad = 1;
+      return lval_sexpr();
+    }
+    return lval_fwd(modules[r->modules + ns - 1].env);
+  }
+  case 'm': {
+    lval *f = lval_fun(LOP_MEMO);
+    f->memo = limg_get_shared(r, 'm', &fresh);
+    if (f->memo) {
+      f->memo->refs++;
+    } else if (fresh) {
+      long max = (long)limg_get(r, 8);
+      f->memo = lmemo_new(NULL, max);
+      limg_keep(r, 'm', f->memo);
+      f->memo->f = limg_get_val(r);
+    } else {
+      lval_del(f);
+      return lval_sexpr();
+    }
+    return f;
+  }
+  case 'p': {
+    lval *f = lval_fun(LOP_PARTIAL);
+    f->partial = limg_get_shared(r, 'p', &fresh);
+    if (f->partial) {
+      f->partial->refs++;
+    } else if (fresh) {
+      lpartial *p = malloc(sizeof(lpartial));
+      p->refs = 1;
+      limg_keep(r, 'p', p);
+      p->need = limg_get(r, 4);
+      p->rest = limg_get(r, 1);
+      p->fn = limg_get_val(r);
+      p->args = limg_get_val(r);
+      f->partial = p;
+    } else {
+      lval_del(f);
+      return lval_sexpr();
+    }
+    return f;
+  }
+  case 'b': {
+    char *name = limg_get_str(r);
+    for (int op = 0; op < LOP_COUNT; op++) {
+      if (strcmp(lbuiltins[op].name, name) == 0) {
+        return lval_fun(op);
+      }
+    }
+    r->bad = 1;
+    return lval_sexpr();
+  }
+  case 'f':
+    return limg_get_lambda(r);
+  default:
+    r->bad = 1;
+    return lval_sexpr();
+  }
+}
+
+/* The contents of the file at 'path', mapped into memory where possible */
+unsigned char *limg_map(char *path, size_t *size) {
+#if LMMAP
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat st;
+  void *p = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (p == MAP_FAILED) {
+    return NULL;
+  }
+  *size = st.st_size;
+  return p;
+#else
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    return NULL;
+  }
+  fseek(f, 0, SEEK_END);
+  long n = ftell(f);
+  rewind(f);
+  unsigned char *p = n > 0 ? malloc(n) : NULL;
+  if (p && fread(p, 1, n, f) != (size_t)n) {
+    free(p);
+    p = NULL;
+  }
+  fclose(f);
+  *size = n;
+  return p;
+#endif
+}
+
+void limg_unmap(unsigned char *p, size_t size) {
+#if LMMAP
+  munmap(p, size);
+#else
+  free(p);
+#endif
+}
+
+/* Restore the image at 'path' into 'e', the root environment */
+lval *limg_load(lenv *e, char *path) {
+  size_t size;
+  unsigned char *data = limg_map(path, &size);
+  if (!data) {
+    return lval_err("Could not load image %s", path);
+  }
+  size_t magic = strlen(LIMG_MAGIC);
+  if (size <= magic || memcmp(data, LIMG_MAGIC, magic) != 0) {
+    limg_unmap(data, size);
+    return lval_err("Not an image: %s", path);
+  }
+  limg_in r = {data + magic, data + size, 0, NULL, NULL, 0, e, modules_count};
+  int intact = limg_get(&r, 1);
+  if (!(intact & 1)) {
+    lfold_intact = 0;
+  }
+  if (!(intact & 2)) {
+    lform_intact = 0;
+  }
+
+  /* Module namespaces sit directly below the root environment */
+  int n = limg_get_count(&r);
+  for (int i = 0; i < n && !r.bad; i++) {
+    char *name = limg_get_str(&r);
+    modules_count++;
+    modules = realloc(modules, sizeof(lmodule) * modules_count);
+    lmodule *m = &modules[modules_count - 1];
+    m->path = malloc(strlen(name) + 1);
+    strcpy(m->path, name);
+    m->env = lenv_new();
+    m->env->par = e;
+    m->env->ns = m->env;
+    m->exports = limg_get(&r, 1) ? limg_get_val(&r) : NULL;
+  }
+  for (int i = 0; i < n && !r.bad; i++) {
+    limg_get_env(&r, modules[r.modules + i].env);
+  }
+  limg_get_env(&r, e);
+
+  int bad = r.bad || r.p != r.end;
+  free(r.objs);
+  free(r.tags);
+  limg_unmap(data, size);
+  if (bad) {
+    return lval_err("Corrupt image %s", path);
+  }
+  return lval_sexpr();
+}
+
+lval *builtin_print(lenv *e, lval *a) {
+#if __EMSCRIPTEN__
+  char *out = malloc(sizeof(char));
+  out[0] = '\0';
+  /* Concat each argument followed by a space */
+  for (int i = 0; i < a->count; i++) {
+    char *str = lval_to_str(a->cell[i]);
+    out = realloc(out, sizeof(char) * (strlen(out) + strlen(str) + 2));
+    strcat(out, str);
+    strcat(out, " ");
+    free(str);
+  }
+  lval *x = lval_str(out);
+  free(out);
+  return x;
+#else
+  /* Print each argument followed by a space */
+  for (int i = 0; i < a->count; i++) {
+    lval_print(a->cell[i]);
+    putchar(' ');
+  }
+
+  /* Print a newline and delete arguments */
+  putchar('\n');
+  lval_del(a);
+
+  return lval_sexpr();
+#endif
+}
+
+lval *builtin_vector(lenv *e, lval *a) {
+  lvec *v = lvec_new(a->count);
+  for (int i = 0; i < a->count; i++) {
+    lvec_push(v, a->cell[i]);
+  }
+  a->count = 0;
+  lval_del(a);
+  return lval_vec(v);
+}
+
+lval *builtin_make_vector(lenv *e, lval *a) {
+  LASSERT_NUM("make-vector", a, 2);
+  LASSERT_TYPE("make-vector", a, 0, LVAL_NUM);
+  LASSERT(a, a->cell[0]->num >= 0,
+          "Function 'make-vector' passed negative length %li.",
+          a->cell[0]->num);
+
+  LASSERT(a, a->cell[0]->num <= INT_MAX,
+          "Function 'make-vector' passed length %li, longer than %i.",
+          a->cell[0]->num, INT_MAX);
+
+  long n = a->cell[0]->num;
+  lvec *v = lvec_new(n);
+  LASSERT(a, v, "Function 'make-vector' could not allocate length %li.", n);
+  for (long i = 0; i < n; i++) {
+    lvec_push(v, lval_copy(a->cell[1]));
+  }
+  lval_del(a);
+  return lval_vec(v);
+}
+
+lval *builtin_vector_len(lenv *e, lval *a) {
+  LASSERT_NUM("vector-len", a, 1);
+  LASSERT_TYPE("vector-len", a, 0, LVAL_VEC);
+
+  lval *r = lval_num(a->cell[0]->vec->count);
+  lval_del(a);
+  return r;
+}
+
+lval *builtin_vector_ref(lenv *e, lval *a) {
+  LASSERT_NUM("vector-ref", a, 2);
+  LASSERT_TYPE("vector-ref", a, 0, LVAL_VEC);
+  LASSERT_TYPE("vector-ref", a, 1, LVAL_NUM);
+  lvec *v = a->cell[0]->vec;
+  long i = a->cell[1]->num;
+  LASSERT_INDEX("vector-ref", a, v, i);
+
+  lval *r = lval_copy(v->items[i]);
+  lval_del(a);
+  return r;
+}
+
+lval *builtin_vector_set(lenv *e, lval *a) {
+  LASSERT_NUM("vector-set!", a, 3);
+  LASSERT_TYPE("vector-set!", a, 0, LVAL_VEC);
+  LASSERT_TYPE("vector-set!", a, 1, LVAL_NUM);
+  lvec *v = a->cell[0]->vec;
+  long i = a->cell[1]->num;
+  LASSERT_INDEX("vector-set!", a, v, i);
+  LASSERT(a, !lvec_holds(a->cell[2], v),
+          "Function 'vector-set!' passed a value holding the vector itself.");
+
+  lval_assign(&v->items[i], lval_pop(a, 2));
+  lval_del(a);
+  return lval_sexpr();
+}
+
+lval *builtin_vector_push(lenv *e, lval *a) {
+  LASSERT_NUM("vector-push!", a, 2);
+  LASSERT_TYPE("vector-push!", a, 0, LVAL_VEC);
+  LASSERT(a, !lvec_holds(a->cell[1], a->cell[0]->vec),
+          "Function 'vector-push!' passed a value holding the vector itself.");
+  LASSERT(a, a->cell[0]->vec->count < INT_MAX,
+          "Function 'vector-push!' passed a vector of the longest length.");
+
+  lvec_push(a->cell[0]->vec, lval_pop(a, 1));
+  lval_del(a);
+  return lval_sexpr();
+}
+
+/* Copy of the elements of a vector from a start index up to an end */
+lval *builtin_vector_slice(lenv *e, lval *a) {
+  LASSERT_NUM("vector-slice", a, 3);
+  LASSERT_TYPE("vector-slice", a, 0, LVAL_VEC);
+  LASSERT_TYPE("vector-slice", a, 1, LVAL_NUM);
+  LASSERT_TYPE("vector-slice", a, 2, LVAL_NUM);
+  lvec *v = a->cell[0]->vec;
+  long start = a->cell[1]->num;
+  long end = a->cell[2]->num;
+  LASSERT(a, 0 <= start && start <= end && end <= v->count,
+          "Function 'vector-slice' passed range %li to %li out of range for "
+          "length %i.",
+          start, end, v->count);
+
+  lvec *r = lvec_new(end - start);
+  for (long i = start; i < end; i++) {
+    lvec_push(r, lval_copy(v->items[i]));
+  }
+  lval_del(a);
+  return lval_vec(r);
+}
+
+lval *builtin_vector_to_list(lenv *e, lval *a) {
+  LASSERT_NUM("vector->list", a, 1);
+  LASSERT_TYPE("vector->list", a, 0, LVAL_VEC);
+
+  lvec *v = a->cell[0]->vec;
+  lval *r = lval_qexpr();
+  r->count = v->count;
+  r->cell = malloc(sizeof(lval *) * v->count);
+  for (int i = 0; i < v->count; i++) {
+    r->cell[i] = lval_copy(v->items[i]);
+  }
+  lval_del(a);
+  return r;
+}
+
+lval *builtin_list_to_vector(lenv *e, lval *a) {
+  LASSERT_NUM("list->vector", a, 1);
+  LASSERT_TYPE("list->vector", a, 0, LVAL_QEXPR);
+
+  return builtin_vector(e, lval_take(a, 0));
+}
+
+lval *builtin_error(lenv *e, lval *a) {
+  LASSERT_NUM("error", a, 1);
+  LASSERT_TYPE("error", a, 0, LVAL_STR);
+
+  /* Construct Error from first argument */
+  lval *err = lval_err(a->cell[0]->str);
+
+  /* Delete arguments and return */
+  lval_del(a);
+  return err;
+}
+
+/* Move lambda 'f' to a new lval, leaving 'f' an empty lambda */
+lval *lval_move(lval *f) {
+  lval *x = lval_alloc();
+  x->type = LVAL_FUN;
+  x->builtin = NULL;
+  x->memo = NULL;
+  x->partial = NULL;
+  x->env = f->env;
+  x->formals = f->formals;
+  x->body = f->body;
+  x->code = f->code;
+  x->node = f->node;
+  f->env = lenv_new();
+  f->formals = lval_sexpr();
+  f->body = lval_sexpr();
+  f->code = NULL;
+  f->node = NULL;
+  return x;
+}
+
+/* Bind arguments 'a' to the formals of lambda 'f'. Returns NULL once every
+ * formal is bound, otherwise the result of the call: an error or the
+ * partially applied function. */
+lval *lval_bind(lenv *e, lval *f, lval *a) {
+
+  /* Given too few arguments the function is applied partially, keeping
+   * the lambda as it is */
+  int rest;
+  if (a->count && a->count < lval_arity(f, &rest)) {
+    return lval_partial(lval_move(f), a);
+  }
+
+  /* Record Argument Counts */
+  int given = a->count;
+  int total = f->formals->count;
+
+  /* While arguments still remain to be processed */
+  while (a->count) {
+
+    /* If we've ran out of formal arguments to bind */
+    if (f->formals->count == 0) {
+      lval_del(a);
+      return lval_err("Function passed too many arguments. "
+                      "Got %i, Expected %i.",
+                      given, total);
+    }
+
+    /* Pop the first symbol from the formals */
+    lval *sym = lval_pop(f->formals, 0);
+
+    /* Special Case to deal with '&' */
+    if (strcmp(sym->sym, "&") == 0) {
+
+      /* Ensure '&' is followed by another symbol */
+      if (f->formals->count != 1) {
+        lval_del(a);
+        return lval_err("Function format invalid. "
+                        "Symbol '&' not followed by single symbol.");
+      }
+
+      /* Next formal should be bound to remaining arguments, which are
+       * all bound now */
+      lval *nsym = lval_pop(f->formals, 0);
+      lenv_bind(f->env, nsym->sym, builtin_list(e, a));
+      lval_del(sym);
+      lval_del(nsym);
+      return NULL;
+    }
+
+    /* Pop the next argument from the list and move it into the
+     * function's environment, it is not used anywhere else */
+    lenv_bind(f->env, sym->sym, lval_pop(a, 0));
+    lval_del(sym);
+  }
+
+  /* Argument list is now bound so can be cleaned up */
+  lval_del(a);
+
+  /* If '&' remains in formal list bind to empty list */
+  if (f->formals->count > 0 && strcmp(f->formals->cell[0]->sym, "&") == 0) {
+
+    /* Check to ensure that & is not passed invalidly. */
+    if (f->formals->count != 2) {
+      return lval_err("Function format invalid. "
+                      "Symbol '&' not followed by single symbol.");
+    }
+
+    /* Pop and delete '&' symbol */
+    lval_del(lval_pop(f->formals, 0));
+
+    /* Pop next symbol and bind it to an empty list */
+    lval *sym = lval_pop(f->formals, 0);
+    lenv_bind(f->env, sym->sym, lval_qexpr());
+    lval_del(sym);
+  }
+
+  /* If all formals have been bound the body can be evaluated */
+  if (f->formals->count == 0) {
+    return NULL;
+  }
+
+  /* Otherwise return partially evaluated function */
+  return lval_copy(f);
+}
+
+/* Check whether every binding of 'e' is shadowed by 'callee', so that no
+ * lookup starting from 'callee' can stop at 'e' */
+int lenv_shadows(lenv *callee, lenv *e) {
+  /* Never drop the root environment or a module namespace */
+  if (!e->par || e->ns == e) {
+    return 0;
+  }
+  if (e->ns && e->ns != callee->ns) {
+    return 0;
+  }
+  for (int i = 0; i < e->count; i++) {
+    if (!lenv_find(callee, e->syms[i])) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* Whether lambda 'f' binds 'sym' when it is called */
+int lval_binds(lval *f, char *sym) {
+  for (int i = 0; i < f->formals->count; i++) {
+    if (strcmp(f->formals->cell[i]->sym, sym) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Argument slot 'slot' of 'e' passed to 'f' in a call in tail position,
+ * after which the function of 'e' is over. When 'f' is a lambda binding
+ * the same symbol no lookup made by the call can reach the slot, so the
+ * value is moved out instead of copied. */
+lval *lval_pass(lenv *e, int slot, lval *f) {
+  if (f->type == LVAL_FUN && !f->builtin && lval_binds(f, e->syms[slot])) {
+    lval *v = e->vals[slot];
+    e->vals[slot] = lval_qexpr();
+    return v;
+  }
+  return lval_copy(e->vals[slot]);
+}
+
+/* Link the environment of a called lambda to its caller's. Callers whose
+ * bindings are all shadowed by the callee can never be reached by its
+ * lookups, so they are skipped to keep recursive chains short. */
+void lenv_link(lenv *callee, lenv *e) {
+  while (lenv_shadows(callee, e)) {
+    e = e->par;
+  }
+  callee->par = e;
+}
+
+lval *lval_call(lenv *e, lval *f, lval *a) {
+
+  /* If Builtin then simply apply that */
+  if (f->builtin) {
+    if (f->memo) {
+      return lmemo_call(e, f->memo, a);
+    }
+    return f->partial ? lpartial_call(e, f, a) : f->builtin(e, a);
+  }
+
+  lval *r;
+  if (f->code && (r = lkern_call(e, f, a->cell, a->count))) {
+    lval_del(a);
+    return r;
+  }
+  r = lval_bind(e, f, a);
+  if (r) {
+    return r;
+  }
+
+  /* Set environment parent to evaluation environment */
+  lenv_link(f->env, e);
+
+  /* Run compiled code if there is some */
+  if (f->code) {
+    return lvm_run(f->env, f->code);
+  }
+  if (f->node) {
+    return lnode_enter(f);
+  }
+
+  /* Evaluate and return */
+  return builtin_eval(f->env, lval_add(lval_sexpr(), lval_copy(f->body)));
+}
+
+/* Functions kept alive by a loop of tail calls, innermost last */
+typedef struct {
+  int count;
+  lval **fns;
+} ltail;
+
+/* Enter lambda 'f', whose formals are bound, called in tail position from
+ * environment 'e'. Finished callers skipped by the link can never be
+ * reached again, so they are freed. */
+void ltail_enter(ltail *t, lval *f, lenv *e) {
+  lenv_link(f->env, e);
+  while (e != f->env->par) {
+    lenv *par = e->par;
+    if (t->count && t->fns[t->count - 1]->env == e) {
+      lval_del(t->fns[--t->count]);
+    }
+    e = par;
+  }
+  t->count++;
+  t->fns = realloc(t->fns, sizeof(lval *) * t->count);
+  t->fns[t->count - 1] = f;
+}
+
+void ltail_exit(ltail *t) {
+  while (t->count) {
+    lval_del(t->fns[--t->count]);
+  }
+  free(t->fns);
+}
+
+/* Whether the C stack is nearly exhausted */
+int lstack_full(void) {
+  char here;
+  long used = lstack_top - &here;
+  return (used < 0 ? -used : used) > LSTACK_LIMIT;
+}
+
+/* Error to return instead of evaluating when the C stack is nearly
+ * exhausted or the evaluation was interrupted, otherwise NULL */
+lval *lval_guard(void) {
+  if (lstack_full()) {
+    return lval_err("Stack overflow. Expression nested too deeply.");
+  }
+  if (linterrupted) {
+    return lval_err("Interrupted.");
+  }
+  return NULL;
+}
+
+/* Evaluate the elements of 'v'. Returns the result, or NULL when a call
+ * remains to be made to the function put in 'f' with the arguments left
+ * in 'v'. */
+lval *lval_eval_sexpr(lenv *e, lval *v, lval **f) {
+
+  /* Chains of list functions are evaluated together */
+  int stages = lpipe_stages(v);
+  if (stages) {
+    lval *items[LPIPE_ITEMS];
+    int n = 0;
+    for (int i = 0; i < stages; i++) {
+      lval *s = lpipe_stage(v, i);
+      for (int j = 0; j < s->count - 1; j++) {
+        items[n++] = lval_eval(e, lval_copy(s->cell[j]));
+      }
+    }
+    items[n] = lval_eval(e, lval_copy(lpipe_stage(v, stages)));
+    lval *x = lpipe_call(e, v, items);
+    lval_del(v);
+    return x;
+  }
+
+  /* Evaluate Children */
+  for (int i = 0; i < v->count; i++) {
+    v->cell[i] = lval_eval(e, v->cell[i]);
+
+    /* '&&' and '||' evaluate their own arguments, stopping early */
+    lval *g = v->cell[0];
+    if (i == 0 && v->count > 1 && g->type == LVAL_FUN && g->builtin &&
+        (g->op == LOP_AND || g->op == LOP_OR)) {
+      g = lval_pop(v, 0);
+      lval *x = g->builtin(e, v);
+      lval_del(g);
+      return x;
+    }
+  }
+
+  /* Error Checking */
+  for (int i = 0; i < v->count; i++) {
+    if (v->cell[i]->type == LVAL_ERR) {
+      return lval_take(v, i);
+    }
+  }
+
+  /* Empty Expression */
+  if (v->count == 0) {
+    return v;
+  }
+
+  /* Single Expression */
+  if (v->count == 1) {
+    return lval_take(v, 0);
+  }
+
+  /* Ensure first element is a function after evaluation */
+  *f = lval_pop(v, 0);
+  if ((*f)->type != LVAL_FUN) {
+    lval *err = lval_err("S-Expression starts with incorrect type. "
+                         "Got %s, Expected %s.",
+                         ltype_name((*f)->type), ltype_name(LVAL_FUN));
+    lval_del(*f);
+    lval_del(v);
+    return err;
+  }
+  return NULL;
+}
+
+/* Evaluate 'v' in 'e'. Calls in tail position, the branch of an 'if' and
+ * the expression given to 'eval' are evaluated by looping instead of
+ * recursing, so tail-recursive functions run in constant stack. */
+lval *lval_eval(lenv *e, lval *v) {
+  ltail t = {0, NULL};
+  lval *x;
+
+  while (1) {
+    if ((x = lval_guard())) {
+      lval_del(v);
+      break;
+    }
+
+    if (v->type == LVAL_SYM) {
+      x = lenv_get(e, v);
+      lval_del(v);
+      break;
+    }
+
+    /* All other lval types remain the same */
+    if (v->type != LVAL_SEXPR) {
+      x = v;
+      break;
+    }
+
+    /* Evaluate Sexpressions */
+    lval *f;
+    if ((x = lval_eval_sexpr(e, v, &f))) {
+      break;
+    }
+
+    /* Builtins that evaluate an expression in tail position */
+    if (f->builtin && (f->op == LOP_IF || f->op == LOP_EVAL)) {
+      v = f->op == LOP_IF ? lval_if_branch(v) : lval_eval_expr(v);
+      lval_del(f);
+      continue;
+    }
+
+    /* Partial applications given all they need call their function */
+    if (f->partial && lpartial_full(f, v->count)) {
+      v = lpartial_unfold(&f, v);
+    }
+
+    /* Lambdas run by the tree-walker are entered in place */
+    if (!f->builtin && !f->code && !f->node) {
+      if ((x = lval_bind(e, f, v))) {
+        lval_del(f);
+        break;
+      }
+      ltail_enter(&t, f, e);
+      e = f->env;
+      v = lval_copy(f->body);
+      v->type = LVAL_SEXPR;
+      continue;
+    }
+
+    /* Call function to get result */
+    x = lval_call(e, f, v);
+    lval_del(f);
+    break;
+  }
+
+  ltail_exit(&t);
+  return x;
+}
+
+/* Bytecode instructions of the virtual machine */
+enum {
+  /* Push a copy of constant 'arg' */
+  LBC_CONST,
+  /* Push a copy of argument slot 'arg' of the function environment */
+  LBC_LOCAL,
+  /* The same for an argument of a call in tail position, see lval_pass */
+  LBC_MOVE,
+  /* Push the value of the symbol of site 'arg' looked up through the
+   * chain, with the inline cache of the site */
+  LBC_GLOBAL,
+  /* Call the function below the top 'arg' values */
+  LBC_CALL,
+  /* Call in tail position, replacing the running function */
+  LBC_TAILCALL,
+  /* Pop a condition and jump to 'arg' when it is false. The instruction
+   * before 'arg' is the jump over the else branch, which is taken when the
+   * condition is invalid. */
+  LBC_BRANCH,
+  /* Jump to 'arg' */
+  LBC_JUMP,
+  /* Return the top of the stack */
+  LBC_RETURN,
+  /* Push a copy of the folded constant 'arg' and take the jump after it,
+   * unless a folded builtin was rebound and the code after the jump must
+   * compute the value */
+  LBC_FOLD,
+  /* Go on past the jump after it to the code of the special form constant
+   * 'arg', unless one was rebound and evaluating the form pushes its value
+   * before the jump is taken */
+  LBC_FORM,
+  /* Pop an operand of '&&' or '||'. When it decides the result, or is
+   * invalid, push the result and jump to 'arg'. */
+  LBC_AND,
+  LBC_OR,
+  /* Push a copy of the lambda constant 'arg' created in the running
+   * function's module */
+  LBC_LAMBDA,
+  /* Pop the condition of a 'while'. When the loop is over push its result
+   * and jump to 'arg'. */
+  LBC_WHILE,
+  /* Pop the value of a loop body and jump back to 'arg', unless it is an
+   * error or the loop must stop, which is left as the result */
+  LBC_LOOP,
+  /* With a count or list and an index on the stack, push the value for
+   * the next iteration of 'dotimes' or 'for-each'. When the loop is over
+   * push its result and jump to 'arg'. */
+  LBC_TIMES,
+  LBC_EACH,
+  /* Pop a value and bind symbol constant 'arg' to it in the function
+   * environment */
+  LBC_PUT,
+  /* Drop the 'arg' values below the top of the stack */
+  LBC_UNWIND,
+  /* Put what symbol constant 'arg' of a loop is bound to in the function
+   * environment below the top of the stack, see lloop_save */
+  LBC_SAVE,
+  /* Give it back from below the top of the stack and drop it there */
+  LBC_RESTORE,
+  /* Replace the top of the stack with the result of 'set!' of symbol
+   * constant 'arg' to it */
+  LBC_SET,
+  /* Call the chain of list functions constant 'arg' with its elements */
+  LBC_PIPE,
+
+  /* Superinstructions replacing the first instruction of a sequence. The
+   * rest of the sequence is left in place as the slow path. */
+
+  /* GLOBAL, LOCAL or CONST twice, CALL 2: a binary builtin on Numbers */
+  LBC_BINOP,
+  /* The same followed by BRANCH: a comparison deciding a jump */
+  LBC_TEST
+};
+
+/* Dispatch with computed goto where the compiler supports it */
+#if defined(__GNUC__) && !defined(__EMSCRIPTEN__) &&                          \
+    !defined(LVM_SWITCH_DISPATCH)
+#define LVM_THREADED 1
+#endif
+
+typedef struct {
+  int op;
+  int arg;
+#if LVM_THREADED
+  /* Address of the handler of 'op' */
+  void *label;
+#endif
+} linstr;
+
+/* Symbol looked up through the chain, with the number of arguments it is
+ * called with or -1 */
+typedef struct {
+  int sym;
+  int n;
+  lcache cache;
+} lsite;
+
+#if LJIT
+typedef int (*ljit_fn)(long *args, long *out, int depth);
+#endif
+
+/* Bytecode of a lambda body, shared by every copy of the lambda */
+struct lcode {
+  int refs;
+  int count;
+  linstr *instrs;
+  int consts_count;
+  lval **consts;
+  int sites_count;
+  lsite *sites;
+  /* Maximum depth of the value stack */
+  int stack;
+  /* Number of formals, or -1 when they have '&' or duplicates */
+  int nargs;
+  /* Calls profiled with Number arguments, and whether they run as a
+   * kernel on unboxed integers, see lkern_call */
+  int calls;
+  int kernel;
+#if LJIT
+  /* Native code of the kernel, and the op of each site it was compiled
+   * for or -1 for calls of itself, see ljit_compile */
+  ljit_fn jit;
+  size_t jit_size;
+  int *jit_ops;
+  int jit_tried;
+#endif
+#if LVM_THREADED
+  /* Whether handler addresses were filled in */
+  int threaded;
+#endif
+};
+
+lcode *lcode_retain(lcode *c) {
+  c->refs++;
+  return c;
+}
+
+void lcode_release(lcode *c) {
+  if (--c->refs > 0) {
+    return;
+  }
+  for (int i = 0; i < c->consts_count; i++) {
+    lval_del(c->consts[i]);
+  }
+  free(c->consts);
+  free(c->sites);
+  free(c->instrs);
+#if LJIT
+  if (c->jit) {
+    munmap(c->jit, c->jit_size);
+  }
+  free(c->jit_ops);
+#endif
+  free(c);
+}
+
+/* State of the compiler while it walks one lambda body */
+typedef struct {
+  lcode *code;
+  lval *formals;
+  /* Formals are not reliably bound to slots, e.g. duplicated names */
+  int no_slots;
+  int depth;
+  /* Whether constant calls may be folded */
+  int fold;
+} lcompiler;
+
+int lcomp_emit(lcompiler *c, int op, int arg) {
+  lcode *code = c->code;
+  code->count++;
+  code->instrs = realloc(code->instrs, sizeof(linstr) * code->count);
+  code->instrs[code->count - 1].op = op;
+  code->instrs[code->count - 1].arg = arg;
+
+  /* Track how deep the value stack gets */
+  switch (op) {
+  case LBC_CONST:
+  case LBC_LOCAL:
+  case LBC_MOVE:
+  case LBC_GLOBAL:
+  case LBC_LAMBDA:
+  case LBC_FOLD:
+  case LBC_TIMES:
+  case LBC_EACH:
+    c->depth++;
+    break;
+  case LBC_CALL:
+  case LBC_TAILCALL:
+    c->depth -= arg;
+    break;
+  case LBC_BRANCH:
+  case LBC_AND:
+  case LBC_OR:
+  case LBC_WHILE:
+  case LBC_LOOP:
+  case LBC_PUT:
+    c->depth--;
+    break;
+  case LBC_UNWIND:
+    c->depth -= arg;
+    break;
+  case LBC_SAVE:
+    c->depth++;
+    break;
+  case LBC_RESTORE:
+    c->depth--;
+    break;
+  }
+  if (c->depth > code->stack) {
+    code->stack = c->depth;
+  }
+  return code->count - 1;
+}
+
+/* Add a copy of 'v' to the constant pool */
+int lcomp_const(lcompiler *c, lval *v) {
+  lcode *code = c->code;
+  code->consts_count++;
+  code->consts = realloc(code->consts, sizeof(lval *) * code->consts_count);
+  code->consts[code->consts_count - 1] = lval_copy(v);
+  return code->consts_count - 1;
+}
+
+/* Add a lookup site of symbol 'sym', called with 'n' arguments or -1 */
+int lcomp_site(lcompiler *c, lval *sym, int n) {
+  lcode *code = c->code;
+  code->sites_count++;
+  code->sites = realloc(code->sites, sizeof(lsite) * code->sites_count);
+  lsite *site = &code->sites[code->sites_count - 1];
+  site->sym = lcomp_const(c, sym);
+  site->n = n;
+  site->cache.env = NULL;
+  site->cache.slot = 0;
+  return code->sites_count - 1;
+}
+
+/* Argument slot bound to symbol 'sym', or -1 if it is not a formal */
+int lcomp_slot(lcompiler *c, char *sym) {
+  if (c->no_slots) {
+    return -1;
+  }
+  int slot = 0;
+  for (int i = 0; i < c->formals->count; i++) {
+    char *formal = c->formals->cell[i]->sym;
+    if (strcmp(formal, "&") == 0) {
+      continue;
+    }
+    if (strcmp(formal, sym) == 0) {
+      return slot;
+    }
+    slot++;
+  }
+  return -1;
+}
+
+/* Whether argument 'i' of the call 'x' is a formal that the arguments
+ * after it neither use nor run any code for */
+int lcomp_passes(lcompiler *c, lval *x, int i) {
+  lval *arg = x->cell[i];
+  if (arg->type != LVAL_SYM || lcomp_slot(c, arg->sym) < 0) {
+    return 0;
+  }
+  for (int j = i + 1; j < x->count; j++) {
+    lval *y = x->cell[j];
+    if (y->type == LVAL_SEXPR ||
+        (y->type == LVAL_SYM && strcmp(y->sym, arg->sym) == 0)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* Rebinding a formal moves it, so slots are only used for distinct names */
+int lcomp_has_duplicates(lval *formals) {
+  for (int i = 0; i < formals->count; i++) {
+    for (int j = 0; j < i; j++) {
+      if (strcmp(formals->cell[i]->sym, formals->cell[j]->sym) == 0) {
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+/* Check 'x' is a call to the builtin named 'name' not shadowed by a formal,
+ * nor rebound when it is compiled inline */
+int lcomp_is_form(lcompiler *c, lval *x, char *name, int count) {
+  return x->count == count && x->cell[0]->type == LVAL_SYM &&
+         strcmp(x->cell[0]->sym, name) == 0 && lcomp_slot(c, name) == -1 &&
+         (lform_intact || !lform_inlined(name));
+}
+
+/* Opcode of the '&&' or '||' form 'x', or -1 */
+int lcomp_bool_form(lcompiler *c, lval *x) {
+  if (x->count < 3) {
+    return -1;
+  }
+  if (lcomp_is_form(c, x, "&&", x->count)) {
+    return LOP_AND;
+  }
+  if (lcomp_is_form(c, x, "||", x->count)) {
+    return LOP_OR;
+  }
+  return -1;
+}
+
+/* Builtin opcode of the loop or 'set!' form 'x' with literal symbol and
+ * bodies, or -1 */
+int lcomp_loop_form(lcompiler *c, lval *x) {
+  if (lcomp_is_form(c, x, "while", 3) && x->cell[1]->type == LVAL_QEXPR &&
+      x->cell[2]->type == LVAL_QEXPR) {
+    return LOP_WHILE;
+  }
+  if (x->count < 3 || x->cell[1]->type != LVAL_QEXPR ||
+      x->cell[1]->count != 1 || x->cell[1]->cell[0]->type != LVAL_SYM) {
+    return -1;
+  }
+  if (lcomp_is_form(c, x, "set!", 3)) {
+    return LOP_SET;
+  }
+  if (x->cell[x->count - 1]->type != LVAL_QEXPR) {
+    return -1;
+  }
+  if (lcomp_is_form(c, x, "dotimes", 4)) {
+    return LOP_DOTIMES;
+  }
+  if (lcomp_is_form(c, x, "for-each", 4)) {
+    return LOP_FOR_EACH;
+  }
+  return -1;
+}
+
+/* Builtin opcode of the special form 'x' compiled inline, or -1 */
+int lcomp_form(lcompiler *c, lval *x) {
+  if (lcomp_is_form(c, x, "if", 4) && x->cell[2]->type == LVAL_QEXPR &&
+      x->cell[3]->type == LVAL_QEXPR) {
+    return LOP_IF;
+  }
+  int op = lcomp_bool_form(c, x);
+  return op >= 0 ? op : lcomp_loop_form(c, x);
+}
+
+/* Check 'x' is a lambda with literal formals and body, the formals all
+ * symbols */
+int lcomp_is_lambda(lcompiler *c, lval *x) {
+  if (!lcomp_is_form(c, x, "\\", 3) || x->cell[1]->type != LVAL_QEXPR ||
+      x->cell[2]->type != LVAL_QEXPR) {
+    return 0;
+  }
+  for (int i = 0; i < x->cell[1]->count; i++) {
+    if (x->cell[1]->cell[i]->type != LVAL_SYM) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+lval *lfold_value(lcompiler *c, lval *x);
+
+/* Value of the elements of 'x' evaluated as a call if it is a call of a
+ * pure builtin on constants, otherwise NULL */
+lval *lfold_call(lcompiler *c, lval *x) {
+  if (!c->fold || !lfold_intact || x->count < 2 ||
+      x->cell[0]->type != LVAL_SYM || lcomp_slot(c, x->cell[0]->sym) >= 0) {
+    return NULL;
+  }
+  int op = lfold_op(x->cell[0]->sym);
+  if (op < 0) {
+    return NULL;
+  }
+
+  lval *a = lval_sexpr();
+  for (int i = 1; i < x->count; i++) {
+    lval *v = lfold_value(c, x->cell[i]);
+    if (!v) {
+      lval_del(a);
+      return NULL;
+    }
+    lval_add(a, v);
+  }
+
+  /* Errors are left to be reported when the call is made */
+  lval *r = lbuiltins[op].func(NULL, a);
+  if (r->type == LVAL_ERR) {
+    lval_del(r);
+    return NULL;
+  }
+  return r;
+}
+
+/* Value of 'x' if it is a constant or a constant call, otherwise NULL */
+lval *lfold_value(lcompiler *c, lval *x) {
+  switch (x->type) {
+  case LVAL_NUM:
+  case LVAL_STR:
+  case LVAL_QEXPR:
+    return lval_copy(x);
+  case LVAL_SEXPR:
+    return lfold_call(c, x);
+  }
+  return NULL;
+}
+
+lval *lfold_form(lcompiler *c, lval *x);
+
+/* Fold the body 'q' of a lambda or branch of an 'if' */
+lval *lfold_body(lcompiler *c, lval *q) {
+  lval *x = lval_copy(q);
+  x->type = LVAL_SEXPR;
+  x = lfold_form(c, x);
+  if (x->type == LVAL_SEXPR) {
+    x->type = LVAL_QEXPR;
+    return x;
+  }
+  return lval_add(lval_qexpr(), x);
+}
+
+/* Fold the expression 'x' the way the compilers would, for printing */
+lval *lfold_form(lcompiler *c, lval *x) {
+  if (x->type != LVAL_SEXPR) {
+    return x;
+  }
+
+  lval *v = lfold_value(c, x);
+  if (v) {
+    lval_del(x);
+    return v;
+  }
+
+  /* Lambda bodies see the formals of the lambda */
+  int lambda = lcomp_is_lambda(c, x);
+  int fun = lcomp_is_form(c, x, "fun", 3) &&
+            x->cell[1]->type == LVAL_QEXPR &&
+            x->cell[2]->type == LVAL_QEXPR && x->cell[1]->count > 0;
+  if (lambda || fun) {
+    lval *formals = lval_copy(x->cell[1]);
+    if (fun) {
+      lval_del(lval_pop(formals, 0));
+    }
+    lcompiler inner = {NULL, formals, lcomp_has_duplicates(formals), 0, 1};
+    lval *body = lfold_body(&inner, x->cell[2]);
+    lval_del(x->cell[2]);
+    x->cell[2] = body;
+    lval_del(formals);
+    return x;
+  }
+
+  int branches = lcomp_is_form(c, x, "if", 4) &&
+                 x->cell[2]->type == LVAL_QEXPR &&
+                 x->cell[3]->type == LVAL_QEXPR;
+  for (int i = 1; i < x->count; i++) {
+    if (branches && i >= 2) {
+      lval *body = lfold_body(c, x->cell[i]);
+      lval_del(x->cell[i]);
+      x->cell[i] = body;
+    } else {
+      x->cell[i] = lfold_form(c, x->cell[i]);
+    }
+  }
+  return x;
+}
+
+/* Print top level expression 'x' as it is folded */
+void lfold_print(lval *x) {
+  lval *formals = lval_qexpr();
+  lcompiler c = {NULL, formals, 0, 0, 1};
+  lval *folded = lfold_form(&c, lval_copy(x));
+  char *str = lval_to_str(folded);
+  fprintf(stderr, "%s\n", str);
+  free(str);
+  lval_del(folded);
+  lval_del(formals);
+}
+
+void lcomp_expr(lcompiler *c, lval *x, int tail);
+void lcomp_sexpr(lcompiler *c, lval *x, int tail);
+
+/* Compile the special form 'x' of builtin 'op' inline */
+void lcomp_inline(lcompiler *c, lval *x, int op, int tail) {
+
+  /* 'if' becomes a conditional jump */
+  if (op == LOP_IF) {
+    lcomp_expr(c, x->cell[1], 0);
+    int branch = lcomp_emit(c, LBC_BRANCH, 0);
+    int depth = c->depth;
+    lcomp_sexpr(c, x->cell[2], tail);
+    int jump = lcomp_emit(c, LBC_JUMP, 0);
+    c->depth = depth;
+    c->code->instrs[branch].arg = c->code->count;
+    lcomp_sexpr(c, x->cell[3], tail);
+    c->code->instrs[jump].arg = c->code->count;
+    return;
+  }
+
+  /* '&&' and '||' jump to the end once an operand decides the result */
+  if (op == LOP_AND || op == LOP_OR) {
+    int *jumps = malloc(sizeof(int) * x->count);
+    for (int i = 1; i < x->count; i++) {
+      lcomp_expr(c, x->cell[i], 0);
+      jumps[i] = lcomp_emit(c, op == LOP_AND ? LBC_AND : LBC_OR, 0);
+    }
+    lval *r = lval_num(op == LOP_AND);
+    lcomp_emit(c, LBC_CONST, lcomp_const(c, r));
+    lval_del(r);
+    for (int i = 1; i < x->count; i++) {
+      c->code->instrs[jumps[i]].arg = c->code->count;
+    }
+    free(jumps);
+    return;
+  }
+
+  /* Loops jump back over their bodies, 'set!' changes a binding */
+  if (op == LOP_WHILE) {
+    int base = c->depth;
+    int loop = c->code->count;
+    lcomp_sexpr(c, x->cell[1], 0);
+    int end = lcomp_emit(c, LBC_WHILE, 0);
+    lcomp_sexpr(c, x->cell[2], 0);
+    lcomp_emit(c, LBC_LOOP, loop);
+    c->code->instrs[end].arg = c->code->count;
+    c->depth = base + 1;
+    return;
+  }
+  lval *sym = x->cell[1]->cell[0];
+  lfold_forget(sym->sym);
+  lcomp_expr(c, x->cell[2], 0);
+  if (op == LOP_SET) {
+    lcomp_emit(c, LBC_SET, lcomp_const(c, sym));
+    return;
+  }
+  lcomp_emit(c, LBC_SAVE, lcomp_const(c, sym));
+  int base = c->depth - 1;
+  lval *zero = lval_num(0);
+  lcomp_emit(c, LBC_CONST, lcomp_const(c, zero));
+  lval_del(zero);
+  int loop = lcomp_emit(c, op == LOP_DOTIMES ? LBC_TIMES : LBC_EACH, 0);
+  lcomp_emit(c, LBC_PUT, lcomp_const(c, sym));
+  lcomp_sexpr(c, x->cell[3], 0);
+  lcomp_emit(c, LBC_LOOP, loop);
+  c->code->instrs[loop].arg = c->code->count;
+  c->depth = base + 3;
+  lcomp_emit(c, LBC_UNWIND, 2);
+  lcomp_emit(c, LBC_RESTORE, lcomp_const(c, sym));
+}
+
+/* Compile the elements of 'x' as the S-Expression they evaluate to. 'tail'
+ * is set when its value is returned from the function. */
+void lcomp_sexpr(lcompiler *c, lval *x, int tail) {
+
+  /* Empty Expression */
+  if (x->count == 0) {
+    lval *empty = lval_sexpr();
+    lcomp_emit(c, LBC_CONST, lcomp_const(c, empty));
+    lval_del(empty);
+    return;
+  }
+
+  /* Single Expression */
+  if (x->count == 1) {
+    lcomp_expr(c, x->cell[0], tail);
+    return;
+  }
+
+  /* Constant calls of pure builtins are computed once. The call is still
+   * compiled after the constant in case a builtin gets rebound. */
+  lval *v = lfold_call(c, x);
+  if (v) {
+    int depth = c->depth;
+    lcomp_emit(c, LBC_FOLD, lcomp_const(c, v));
+    int jump = lcomp_emit(c, LBC_JUMP, 0);
+    lval_del(v);
+    c->depth = depth;
+    c->fold = 0;
+    lcomp_sexpr(c, x, tail);
+    c->fold = 1;
+    c->code->instrs[jump].arg = c->code->count;
+    return;
+  }
+
+  /* 'if' with literal branches, '&&', '||', loops and 'set!' are compiled
+   * inline. In case one is rebound later the form is guarded, to be
+   * evaluated as written instead. */
+  int op = lcomp_form(c, x);
+  if (op >= 0) {
+    lcomp_emit(c, LBC_FORM, lcomp_const(c, x));
+    int jump = lcomp_emit(c, LBC_JUMP, 0);
+    lcomp_inline(c, x, op, tail);
+    c->code->instrs[jump].arg = c->code->count;
+    return;
+  }
+
+  /* Chains of list functions are called together, see lpipe_call */
+  int stages = lpipe_stages(x);
+  if (stages) {
+    int base = c->depth;
+    for (int i = 0; i < stages; i++) {
+      lval *s = lpipe_stage(x, i);
+      for (int j = 0; j < s->count - 1; j++) {
+        lcomp_expr(c, s->cell[j], 0);
+      }
+    }
+    lcomp_expr(c, lpipe_stage(x, stages), 0);
+    lcomp_emit(c, LBC_PIPE, lcomp_const(c, x));
+    c->depth = base + 1;
+    return;
+  }
+
+  /* Lambdas with literal bodies are compiled once with the function */
+  if (lcomp_is_lambda(c, x)) {
+    lval *f = lval_lambda(lval_copy(x->cell[1]), lval_copy(x->cell[2]));
+    f->code = lcode_compile(f->formals, f->body);
+    lcomp_emit(c, LBC_LAMBDA, lcomp_const(c, f));
+    lval_del(f);
+    return;
+  }
+
+  /* Otherwise evaluate every element and call the first */
+  lval *head = x->cell[0];
+  if (head->type == LVAL_SYM && lcomp_slot(c, head->sym) < 0) {
+    lcomp_emit(c, LBC_GLOBAL, lcomp_site(c, head, x->count - 1));
+  } else {
+    lcomp_expr(c, head, 0);
+  }
+  for (int i = 1; i < x->count; i++) {
+    if (tail && lcomp_passes(c, x, i)) {
+      lcomp_emit(c, LBC_MOVE, lcomp_slot(c, x->cell[i]->sym));
+    } else {
+      lcomp_expr(c, x->cell[i], 0);
+    }
+  }
+  lcomp_emit(c, tail ? LBC_TAILCALL : LBC_CALL, x->count - 1);
+}
+
+void lcomp_expr(lcompiler *c, lval *x, int tail) {
+  switch (x->type) {
+  case LVAL_SYM: {
+    int slot = lcomp_slot(c, x->sym);
+    if (slot >= 0) {
+      lcomp_emit(c, LBC_LOCAL, slot);
+    } else {
+      lcomp_emit(c, LBC_GLOBAL, lcomp_site(c, x, -1));
+    }
+    break;
+  }
+  case LVAL_SEXPR:
+    lcomp_sexpr(c, x, tail);
+    break;
+  /* All other lval types evaluate to themselves */
+  default:
+    lcomp_emit(c, LBC_CONST, lcomp_const(c, x));
+    break;
+  }
+}
+
+/* Whether instruction 'i' pushes an operand without side effects */
+int lcode_is_operand(lcode *c, int i) {
+  return i < c->count &&
+         (c->instrs[i].op == LBC_LOCAL || c->instrs[i].op == LBC_CONST);
+}
+
+/* Replace common instruction sequences with superinstructions */
+void lcode_fuse(lcode *c) {
+  for (int i = 0; i + 3 < c->count; i++) {
+    linstr *in = c->instrs + i;
+    if (in[0].op == LBC_GLOBAL && lcode_is_operand(c, i + 1) &&
+        lcode_is_operand(c, i + 2) && in[3].op == LBC_CALL &&
+        in[3].arg == 2) {
+      in[0].op = in[4].op == LBC_BRANCH ? LBC_TEST : LBC_BINOP;
+    }
+  }
+}
+
+/* Formals of compiled lambdas may rebind builtins in their callers */
+void lfold_forget_formals(lval *formals) {
+  for (int i = 0; i < formals->count; i++) {
+    lfold_forget(formals->cell[i]->sym);
+  }
+}
+
+/* Compile a lambda body to bytecode. Formals are bound to the function
+ * environment in order, so formal 'i' lives in slot 'i'. */
+lcode *lcode_compile(lval *formals, lval *body) {
+  lcompiler c;
+  c.code = malloc(sizeof(lcode));
+  c.code->refs = 1;
+  c.code->count = 0;
+  c.code->instrs = NULL;
+  c.code->consts_count = 0;
+  c.code->consts = NULL;
+  c.code->sites_count = 0;
+  c.code->sites = NULL;
+  c.code->stack = 0;
+  c.code->calls = 0;
+  c.code->kernel = LKERN_PROFILE;
+#if LJIT
+  c.code->jit = NULL;
+  c.code->jit_size = 0;
+  c.code->jit_ops = NULL;
+  c.code->jit_tried = 0;
+#endif
+  c.formals = formals;
+  c.no_slots = lcomp_has_duplicates(formals);
+  c.code->nargs = c.no_slots ? -1 : formals->count;
+  for (int i = 0; i < formals->count; i++) {
+    if (strcmp(formals->cell[i]->sym, "&") == 0) {
+      c.code->nargs = -1;
+    }
+  }
+  c.depth = 0;
+  c.fold = 1;
+
+  lfold_forget_formals(formals);
+  lcomp_sexpr(&c, body, 1);
+  lcomp_emit(&c, LBC_RETURN, 0);
+  lcode_fuse(c.code);
+#if LVM_THREADED
+  c.code->threaded = 0;
+#endif
+  return c.code;
+}
+
+/* Check the evaluated elements of a call. Returns the result when the call
+ * cannot be made: the first error, or a non-function head. */
+lval *lvm_check(lval **items, int n) {
+
+  /* Errors among the evaluated elements are the result */
+  int bad = -1;
+  for (int i = 0; i <= n && bad < 0; i++) {
+    if (items[i]->type == LVAL_ERR) {
+      bad = i;
+    }
+  }
+  lval *err = NULL;
+  if (bad >= 0) {
+    err = items[bad];
+    items[bad] = NULL;
+  } else if (items[0]->type != LVAL_FUN) {
+    err = lval_err("S-Expression starts with incorrect type. "
+                   "Got %s, Expected %s.",
+                   ltype_name(items[0]->type), ltype_name(LVAL_FUN));
+  }
+
+  if (err) {
+    for (int i = 0; i <= n; i++) {
+      if (items[i]) {
+        lval_del(items[i]);
+      }
+    }
+  }
+  return err;
+}
+
+/* Move the 'n' values at 'items' into an argument list */
+lval *lvm_args(lval **items, int n) {
+  lval *a = lval_sexpr();
+  a->count = n;
+  a->cell = malloc(sizeof(lval *) * n);
+  memcpy(a->cell, items, sizeof(lval *) * n);
+  return a;
+}
+
+/* The value bound to the symbol of site 'site' of 'c', without copying
+ * it, or NULL */
+lval *lvm_site_ref(lenv *e, lcode *c, lsite *site) {
+  lval **slot = lenv_cached(e, c->consts[site->sym], &site->cache);
+  return slot ? *slot : NULL;
+}
+
+/* Push the value of the symbol of site 'site' of 'c' */
+lval *lvm_site_get(lenv *e, lcode *c, lsite *site) {
+  return lenv_callee(e, c->consts[site->sym], &site->cache, site->n);
+}
+
+/* Call the function in items[0] with the 'n' arguments after it */
+lval *lvm_call(lenv *e, lval **items, int n) {
+  lval *err = lvm_check(items, n);
+  if (err) {
+    return err;
+  }
+
+  lval *f = items[0];
+  lval *result = lval_call(e, f, lvm_args(items + 1, n));
+  lval_del(f);
+  return result;
+}
+
+/* Number of nested 'map', 'filter' and 'foldl' calls in 'x' taking the
+ * list made by the next one, with 'foldl' only outermost, or 0 when there
+ * are not at least two */
+int lpipe_stages(lval *x) {
+  if (!lpipe_fuse) {
+    return 0;
+  }
+  int n = 0;
+  while (n < LPIPE_STAGES && x->type == LVAL_SEXPR && x->count >= 3 &&
+         x->cell[0]->type == LVAL_SYM) {
+    char *sym = x->cell[0]->sym;
+    int map = x->count == 3 &&
+              (strcmp(sym, "map") == 0 || strcmp(sym, "filter") == 0);
+    int fold = n == 0 && x->count == 4 && strcmp(sym, "foldl") == 0;
+    if (!map && !fold) {
+      break;
+    }
+    n++;
+    x = x->cell[x->count - 1];
+  }
+  return n > 1 ? n : 0;
+}
+
+/* Call 's' of the chain 'x', or the expression of its list after the last */
+lval *lpipe_stage(lval *x, int s) {
+  while (s--) {
+    x = x->cell[x->count - 1];
+  }
+  return x;
+}
+
+/* Number of elements evaluated for the chain 'x' */
+int lpipe_items(lval *x) {
+  int stages = lpipe_stages(x);
+  int n = 1;
+  for (int i = 0; i < stages; i++) {
+    n += lpipe_stage(x, i)->count - 1;
+  }
+  return n;
+}
+
+/* Whether builtin 'op' has no effect besides its result, calling no
+ * function but the branches it is given */
+int lpipe_pure_op(int op) {
+  switch (op) {
+  case LOP_AND:
+  case LOP_OR:
+  case LOP_NOT:
+  case LOP_IF:
+  case LOP_LEN:
+  case LOP_NTH:
+  case LOP_LAST:
+  case LOP_TAKE:
+  case LOP_DROP:
+  case LOP_ELEM:
+  case LOP_SUM:
+  case LOP_PROD:
+    return 1;
+  }
+  return lfold_op(lbuiltins[op].name) == op;
+}
+
+int lpipe_pure(lenv *e, lval *f, lval **scope, int n);
+
+/* Whether evaluating the body 'x' of the lambdas whose formals are in
+ * 'scope' calls only pure functions. Formals are bound by the caller, so
+ * they must not be called. */
+int lpipe_pure_body(lenv *e, lval *x, lval **scope, int n) {
+  for (int i = 0; i < x->count; i++) {
+    lval *y = x->cell[i];
+    if (y->type == LVAL_SEXPR || y->type == LVAL_QEXPR) {
+      if (!lpipe_pure_body(e, y, scope, n)) {
+        return 0;
+      }
+      continue;
+    }
+    if (y->type != LVAL_SYM) {
+      continue;
+    }
+    int formal = 0;
+    for (int s = 0; s < n && !formal; s++) {
+      formal = lval_contains(scope[s], y);
+    }
+    if (formal) {
+      if (i == 0 && x->count > 1) {
+        return 0;
+      }
+      continue;
+    }
+    lval *v = lenv_ref(e, y);
+    if (v && v->type == LVAL_FUN && !lpipe_pure(e, v, scope, n)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* Whether calling 'f' from 'e' has no effect besides its result, so the
+ * order of calls in a fused chain can't be observed */
+int lpipe_pure(lenv *e, lval *f, lval **scope, int n) {
+  if (f->type != LVAL_FUN || f->memo || f->partial) {
+    return 0;
+  }
+  if (f->builtin) {
+    return lpipe_pure_op(f->op);
+  }
+  if (n == LPIPE_DEPTH || f->env->count) {
+    return 0;
+  }
+  scope[n] = f->formals;
+  return lpipe_pure_body(e, f->body, scope, n + 1);
+}
+
+/* Call 'f', a pure function, with the 'n' values 'args', leaving them as
+ * they are. Builtins on two Numbers and lambdas running as kernels take
+ * the values in place, anything else is called with copies. */
+lval *lpipe_apply(lenv *e, lval *f, lval **args, int n) {
+  long r;
+  if (n == 2 && args[0]->type == LVAL_NUM && args[1]->type == LVAL_NUM &&
+      lvm_binop(f, args[0]->num, args[1]->num, &r)) {
+    return lval_num(r);
+  }
+  lval *x;
+  if (!f->builtin && f->code && (x = lkern_call(e, f, args, n))) {
+    return x;
+  }
+  lval *a = lval_sexpr();
+  for (int i = 0; i < n; i++) {
+    lval_add(a, lval_copy(args[i]));
+  }
+  if (f->builtin) {
+    return lval_call(e, f, a);
+  }
+
+  /* Binding arguments consumes the formals of a lambda */
+  lval *g = lval_callee(f, n);
+  x = lval_call(e, g, a);
+  lval_del(g);
+  return x;
+}
+
+/* Pass element 'x' through the 'n' fused calls whose elements start at
+ * 'offs', adding what comes out to 'r' or folding it into 'r'. 'x' is
+ * taken when 'own' is set and copied only if it is kept as it is. Returns
+ * 0 on an error, which replaces 'r'. */
+int lpipe_push(lenv *e, lval **items, int *offs, int n, lval *x, int own,
+               lval **r) {
+  for (int s = n - 1; s >= 0; s--) {
+    int op = items[offs[s]]->op;
+    lval *f = items[offs[s] + 1];
+
+    /* Every call evaluates the elements of the list it is given */
+    if (x->type == LVAL_SYM || x->type == LVAL_SEXPR) {
+      x = lval_eval(e, own ? x : lval_copy(x));
+      own = 1;
+      if (x->type == LVAL_ERR) {
+        lval_del(*r);
+        *r = x;
+        return 0;
+      }
+    }
+
+    if (op == LOP_FOLDL) {
+      lval *args[] = {*r, x};
+      lval *v = lpipe_apply(e, f, args, 2);
+      lval_del(*r);
+      if (own) {
+        lval_del(x);
+      }
+      *r = v;
+      return v->type != LVAL_ERR;
+    }
+    lval *v = lpipe_apply(e, f, &x, 1);
+    if (op == LOP_MAP && v->type != LVAL_ERR) {
+      if (own) {
+        lval_del(x);
+      }
+      x = v;
+      own = 1;
+      continue;
+    }
+
+    /* 'filter' keeps the element it was given */
+    if (v->type != LVAL_ERR && v->type != LVAL_NUM) {
+      lval *err = lval_err("Function '%s' passed incorrect type. Got %s, "
+                           "Expected %s.",
+                           "if", ltype_name(v->type), ltype_name(LVAL_NUM));
+      lval_del(v);
+      v = err;
+    }
+    int keep = v->type == LVAL_NUM && v->num;
+    if (v->type == LVAL_ERR) {
+      lval_del(*r);
+      *r = v;
+    } else {
+      lval_del(v);
+    }
+    if (!keep) {
+      if (own) {
+        lval_del(x);
+      }
+      return (*r)->type != LVAL_ERR;
+    }
+  }
+  lval_add(*r, own ? x : lval_copy(x));
+  return 1;
+}
+
+/* Call the chain 'form' with its evaluated elements 'items', which are
+ * taken. When they are the builtins called with pure functions, making one
+ * pass over each element needs no intermediate lists, and as nothing else
+ * can see the order of the calls the first error is returned as is. */
+lval *lpipe_call(lenv *e, lval *form, lval **items) {
+  int n = lpipe_stages(form);
+  int offs[LPIPE_STAGES + 1];
+  offs[0] = 0;
+  for (int s = 0; s < n; s++) {
+    offs[s + 1] = offs[s] + lpipe_stage(form, s)->count - 1;
+  }
+  lval *l = items[offs[n]];
+
+  int fused = l->type == LVAL_QEXPR;
+  for (int s = 0; s < n && fused; s++) {
+    lval *f = items[offs[s]];
+    lval *scope[LPIPE_DEPTH];
+    int fold = offs[s + 1] - offs[s] == 3;
+    fused = f->type == LVAL_FUN && f->builtin &&
+            (fold ? f->op == LOP_FOLDL
+                  : f->op == LOP_MAP || f->op == LOP_FILTER) &&
+            lpipe_pure(e, items[offs[s] + 1], scope, 0);
+    for (int i = offs[s] + 1; i < offs[s + 1] && fused; i++) {
+      fused = items[i]->type != LVAL_ERR;
+    }
+  }
+
+  /* Elements are evaluated too, which must call nothing */
+  for (int i = 0; i < l->count && fused; i++) {
+    fused = l->cell[i]->type != LVAL_SEXPR || l->cell[i]->count == 0;
+  }
+
+  if (fused) {
+    lval *r = items[0]->op == LOP_FOLDL ? lval_copy(items[2]) : lval_qexpr();
+    for (int i = 0; i < l->count; i++) {
+      if (!lpipe_push(e, items, offs, n, l->cell[i], 0, &r)) {
+        break;
+      }
+    }
+    for (int i = 0; i <= offs[n]; i++) {
+      lval_del(items[i]);
+    }
+    return r;
+  }
+
+  /* Otherwise each call is made with the list the next one returns */
+  lval *r = l;
+  for (int s = n - 1; s >= 0; s--) {
+    lval *call[4];
+    int k = offs[s + 1] - offs[s];
+    memcpy(call, items + offs[s], sizeof(lval *) * k);
+    call[k] = r;
+    r = lvm_call(e, call, k);
+  }
+  return r;
+}
+
+/* Make room for 'n' values on a VM stack */
+#define LVM_RESERVE(stack, cap, n)                                             \
+  if ((n) > cap) {                                                             \
+    cap = (n) * 2;                                                             \
+    stack = realloc(stack, sizeof(lval *) * cap);                              \
+  }
+
+/* A running compiled function. Calls between compiled functions push frames
+ * on a heap stack instead of recursing in C. */
+typedef struct {
+  lcode *code;
+  linstr *ip;
+  lenv *env;
+  /* Function owning 'env', NULL for the frame lvm_run was entered with */
+  lval *fn;
+  /* Start of the frame on the value stack */
+  int base;
+  ltail tail;
+  /* Table to remember the result in for the arguments 'key', if any */
+  lmemo *memo;
+  lval *key;
+} lframe;
+
+/* Error to return instead of making a call, or NULL if it may proceed */
+lval *lvm_guard(void) {
+  if (lvm_depth >= lvm_max_depth) {
+    return lval_err("Maximum recursion depth of %i exceeded.", lvm_max_depth);
+  }
+  return lval_guard();
+}
+
+/* Apply the binary builtin 'f' to Numbers 'x' and 'y' directly. Returns 0
+ * when 'f' is not such a builtin or the generic path must report an error. */
+int lvm_binop(lval *f, long x, long y, long *r) {
+  if (!f || f->type != LVAL_FUN || !f->builtin) {
+    return 0;
+  }
+  switch (f->op) {
+  case LOP_ADD:
+    *r = x + y;
+    return 1;
+  case LOP_SUB:
+    *r = x - y;
+    return 1;
+  case LOP_MUL:
+    *r = x * y;
+    return 1;
+  case LOP_DIV:
+    if (y == 0) {
+      return 0;
+    }
+    *r = x / y;
+    return 1;
+  case LOP_LT:
+    *r = x < y;
+    return 1;
+  case LOP_LTE:
+    *r = x <= y;
+    return 1;
+  case LOP_GT:
+    *r = x > y;
+    return 1;
+  case LOP_GTE:
+    *r = x >= y;
+    return 1;
+  case LOP_EQ:
+    *r = x == y;
+    return 1;
+  case LOP_NE:
+    *r = x != y;
+    return 1;
+  }
+  return 0;
+}
+
+/* Kernels: compiled lambdas called with Numbers only run on unboxed
+ * integers. Each call resolves the functions the lambda calls, which must
+ * be binary builtins on Numbers or the lambda itself. Anything else
+ * deoptimizes: as a kernel has no side effects, the call is simply made
+ * again with the bytecode, which is used from then on. Special forms run as
+ * compiled, so kernels are only used while none is rebound. */
+
+/* Whether the bytecode 'c' only has instructions a kernel can run */
+int lkern_check(lcode *c) {
+  if (c->nargs < 0) {
+    return 0;
+  }
+  for (int i = 0; i < c->count; i++) {
+    linstr *in = &c->instrs[i];
+    switch (in->op) {
+    case LBC_CONST:
+    case LBC_FOLD:
+      if (c->consts[in->arg]->type != LVAL_NUM) {
+        return 0;
+      }
+      break;
+    case LBC_LOCAL:
+    case LBC_MOVE:
+      if (in->arg >= c->nargs) {
+        return 0;
+      }
+      break;
+    case LBC_GLOBAL:
+      if (c->sites[in->arg].n < 0) {
+        return 0;
+      }
+      break;
+    case LBC_CALL:
+    case LBC_TAILCALL:
+    case LBC_BRANCH:
+    case LBC_JUMP:
+    case LBC_RETURN:
+    case LBC_AND:
+    case LBC_OR:
+    case LBC_FORM:
+    case LBC_BINOP:
+    case LBC_TEST:
+      break;
+    default:
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* Put the function called at each site of 'c' looked up from 'e' in 'fns',
+ * NULL where it is the lambda itself. Returns 0 if one is neither. */
+int lkern_resolve(lenv *e, lcode *c, lval **fns) {
+  for (int i = 0; i < c->sites_count; i++) {
+    lsite *site = &c->sites[i];
+    lval *f = lvm_site_ref(e, c, site);
+    long r;
+    if (site->n == 2 && lvm_binop(f, 1, 1, &r)) {
+      fns[i] = f;
+    } else if (f && f->type == LVAL_FUN && !f->builtin && f->code == c &&
+               !f->env->count && site->n == c->nargs) {
+      fns[i] = NULL;
+    } else {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* Operand of a BINOP or TEST in a kernel */
+#define LKERN_OPERAND(c, in, args)                                             \
+  ((in)->op == LBC_LOCAL ? (args)[(in)->arg] : (c)->consts[(in)->arg]->num)
+
+/* Whether a kernel can make a call 'depth' calls below the one entered
+ * from the VM */
+int lkern_room(int depth) {
+  return lvm_depth + depth < lvm_max_depth && !lstack_full();
+}
+
+#if LJIT
+
+/* Baseline JIT: kernels called often enough are compiled to x86-64 code,
+ * with their stack in the native frame and the op of each site inlined.
+ * Calls of itself are native calls, and limits are checked by calling back
+ * into lkern_room. Code compiled for other ops than the sites resolve to
+ * is left to lkern_run. */
+
+typedef struct {
+  unsigned char *bytes;
+  int count;
+  int cap;
+  /* Offsets of rel32 operands and the labels they jump to */
+  int fixups_count;
+  int *fixups;
+} ljit_buf;
+
+/* Labels besides instructions, which are numbered from 0 */
+enum { LJIT_START = -1, LJIT_BODY = -2, LJIT_DEOPT = -3, LJIT_EXIT = -4 };
+
+void ljit_emit(ljit_buf *b, const char *s, int n) {
+  if (b->count + n + 8 > b->cap) {
+    b->cap = b->cap * 2 + n + 8;
+    b->bytes = realloc(b->bytes, b->cap);
+  }
+  memcpy(b->bytes + b->count, s, n);
+  b->count += n;
+}
+#define LJIT_EMIT(b, s) ljit_emit(b, s, sizeof(s) - 1)
+
+void ljit_emit32(ljit_buf *b, int v) { ljit_emit(b, (char *)&v, 4); }
+void ljit_emit64(ljit_buf *b, long v) { ljit_emit(b, (char *)&v, 8); }
+
+/* Emit the rel32 operand of a jump or call to 'label' */
+void ljit_label(ljit_buf *b, int label) {
+  b->fixups = realloc(b->fixups, sizeof(int) * 2 * (b->fixups_count + 1));
+  b->fixups[2 * b->fixups_count] = b->count;
+  b->fixups[2 * b->fixups_count + 1] = label;
+  b->fixups_count++;
+  ljit_emit32(b, 0);
+}
+
+void ljit_jump(ljit_buf *b, int label) {
+  LJIT_EMIT(b, "\xE9");
+  ljit_label(b, label);
+}
+
+/* jz / jnz */
+void ljit_jump_if(ljit_buf *b, int nonzero, int label) {
+  ljit_emit(b, nonzero ? "\x0F\x85" : "\x0F\x84", 2);
+  ljit_label(b, label);
+}
+
+/* mov rax, [rsp + 8 * slot] and the other way around */
+void ljit_load(ljit_buf *b, int slot) {
+  LJIT_EMIT(b, "\x48\x8B\x84\x24");
+  ljit_emit32(b, 8 * slot);
+}
+void ljit_store(ljit_buf *b, int slot) {
+  LJIT_EMIT(b, "\x48\x89\x84\x24");
+  ljit_emit32(b, 8 * slot);
+}
+
+/* Load the LOCAL or CONST operand 'in' into rax, or rcx */
+void ljit_operand(ljit_buf *b, lcode *c, linstr *in, int rcx) {
+  if (in->op == LBC_LOCAL) {
+    ljit_emit(b, rcx ? "\x48\x8B\x8B" : "\x48\x8B\x83", 3);
+    ljit_emit32(b, 8 * in->arg);
+  } else {
+    ljit_emit(b, rcx ? "\x48\xB9" : "\x48\xB8", 2);
+    ljit_emit64(b, c->consts[in->arg]->num);
+  }
+}
+
+/* rax = rax 'op' rcx, deoptimizing where lvm_binop fails */
+void ljit_op(ljit_buf *b, int op) {
+  switch (op) {
+  case LOP_ADD:
+    LJIT_EMIT(b, "\x48\x01\xC8");
+    return;
+  case LOP_SUB:
+    LJIT_EMIT(b, "\x48\x29\xC8");
+    return;
+  case LOP_MUL:
+    LJIT_EMIT(b, "\x48\x0F\xAF\xC1");
+    return;
+  case LOP_DIV:
+    LJIT_EMIT(b, "\x48\x85\xC9");
+    ljit_jump_if(b, 0, LJIT_DEOPT);
+    LJIT_EMIT(b, "\x48\x99\x48\xF7\xF9");
+    return;
+  }
+  /* cmp rax, rcx; setcc al; movzx eax, al */
+  LJIT_EMIT(b, "\x48\x39\xC8\x0F");
+  switch (op) {
+  case LOP_LT:
+    LJIT_EMIT(b, "\x9C");
+    break;
+  case LOP_LTE:
+    LJIT_EMIT(b, "\x9E");
+    break;
+  case LOP_GT:
+    LJIT_EMIT(b, "\x9F");
+    break;
+  case LOP_GTE:
+    LJIT_EMIT(b, "\x9D");
+    break;
+  case LOP_EQ:
+    LJIT_EMIT(b, "\x94");
+    break;
+  default:
+    LJIT_EMIT(b, "\x95");
+    break;
+  }
+  LJIT_EMIT(b, "\xC0\x0F\xB6\xC0");
+}
+
+/* Record that instruction 'i' is reached with the stack 'sites' of
+ * 'depth' values, each the site standing for its function or -1. Returns
+ * 0 if it was reached before with another stack. */
+int ljit_reach(int *depths, int *stacks, int size, int *work, int *count,
+               int i, int depth, int *sites) {
+  int *at = stacks + i * size;
+  if (depths[i] >= 0) {
+    return depths[i] == depth && !memcmp(at, sites, sizeof(int) * depth);
+  }
+  depths[i] = depth;
+  memcpy(at, sites, sizeof(int) * depth);
+  work[(*count)++] = i;
+  return 1;
+}
+
+/* Find the stack at each reached instruction of kernel 'c' calling 'fns'
+ * into 'depths' and 'stacks'. Returns 0 when a call is not of a site or a
+ * site is used as a value, which only lkern_run checks for. */
+int ljit_flow(lcode *c, lval **fns, int *depths, int *stacks) {
+  int size = c->stack + 1;
+  int *work = malloc(sizeof(int) * (c->count + 1));
+  int count = 0;
+  int s[size + 1];
+  int ok = 1;
+  for (int i = 0; i < c->count; i++) {
+    depths[i] = -1;
+  }
+  ljit_reach(depths, stacks, size, work, &count, 0, 0, s);
+
+#define LJIT_REACH(i, d)                                                       \
+  ok = ok && ljit_reach(depths, stacks, size, work, &count, (i), (d), s)
+  while (ok && count) {
+    int i = work[--count];
+    linstr *in = &c->instrs[i];
+    int d = depths[i];
+    memcpy(s, stacks + i * size, sizeof(int) * d);
+    switch (in->op) {
+    case LBC_CONST:
+    case LBC_LOCAL:
+    case LBC_MOVE:
+      s[d] = -1;
+      LJIT_REACH(i + 1, d + 1);
+      break;
+    case LBC_GLOBAL:
+      s[d] = in->arg;
+      LJIT_REACH(i + 1, d + 1);
+      break;
+    case LBC_FOLD:
+      LJIT_REACH(i + 2, d);
+      s[d] = -1;
+      LJIT_REACH(in[1].arg, d + 1);
+      break;
+    case LBC_FORM:
+      LJIT_REACH(i + 2, d);
+      break;
+    case LBC_BINOP:
+    case LBC_TEST:
+      if (!fns[in->arg]) {
+        s[d] = in->arg;
+        LJIT_REACH(i + 1, d + 1);
+      } else if (in->op == LBC_BINOP) {
+        s[d] = -1;
+        LJIT_REACH(i + 4, d + 1);
+      } else {
+        LJIT_REACH(i + 5, d);
+        LJIT_REACH(in[4].arg, d);
+      }
+      break;
+    case LBC_CALL:
+    case LBC_TAILCALL: {
+      int base = d - in->arg - 1;
+      ok = base >= 0 && s[base] >= 0;
+      for (int j = base + 1; ok && j < d; j++) {
+        ok = s[j] < 0;
+      }
+      if (ok && in->op == LBC_CALL) {
+        s[base] = -1;
+        LJIT_REACH(i + 1, base + 1);
+      }
+      break;
+    }
+    case LBC_BRANCH:
+      ok = d > 0 && s[d - 1] < 0;
+      LJIT_REACH(i + 1, d - 1);
+      LJIT_REACH(in->arg, d - 1);
+      break;
+    case LBC_JUMP:
+      LJIT_REACH(in->arg, d);
+      break;
+    case LBC_AND:
+    case LBC_OR:
+      ok = d > 0 && s[d - 1] < 0;
+      LJIT_REACH(i + 1, d - 1);
+      LJIT_REACH(in->arg, d);
+      break;
+    case LBC_RETURN:
+      ok = d > 0 && s[d - 1] < 0;
+      break;
+    default:
+      ok = 0;
+    }
+  }
+#undef LJIT_REACH
+  free(work);
+  return ok;
+}
+
+/* Emit instruction 'i' of kernel 'c' calling 'fns', reached with 'sites'
+ * of depth 'd' */
+void ljit_instr(ljit_buf *b, lcode *c, lval **fns, int i, int d, int *sites) {
+  linstr *in = &c->instrs[i];
+  switch (in->op) {
+  case LBC_CONST:
+    LJIT_EMIT(b, "\x48\xB8");
+    ljit_emit64(b, c->consts[in->arg]->num);
+    ljit_store(b, d);
+    return;
+  case LBC_LOCAL:
+  case LBC_MOVE:
+    LJIT_EMIT(b, "\x48\x8B\x83");
+    ljit_emit32(b, 8 * in->arg);
+    ljit_store(b, d);
+    return;
+  case LBC_GLOBAL:
+    return;
+  case LBC_FOLD:
+    /* mov rax, &lfold_intact; cmp dword [rax], 0 */
+    LJIT_EMIT(b, "\x48\xB8");
+    ljit_emit64(b, (long)&lfold_intact);
+    LJIT_EMIT(b, "\x83\x38\x00");
+    ljit_jump_if(b, 0, i + 2);
+    LJIT_EMIT(b, "\x48\xB8");
+    ljit_emit64(b, c->consts[in->arg]->num);
+    ljit_store(b, d);
+    ljit_jump(b, in[1].arg);
+    return;
+  case LBC_FORM:
+    ljit_jump(b, i + 2);
+    return;
+  case LBC_BINOP:
+  case LBC_TEST:
+    if (!fns[in->arg]) {
+      return;
+    }
+    ljit_operand(b, c, in + 1, 0);
+    ljit_operand(b, c, in + 2, 1);
+    ljit_op(b, fns[in->arg]->op);
+    if (in->op == LBC_BINOP) {
+      ljit_store(b, d);
+      ljit_jump(b, i + 4);
+    } else {
+      LJIT_EMIT(b, "\x48\x85\xC0");
+      ljit_jump_if(b, 0, in[4].arg);
+      ljit_jump(b, i + 5);
+    }
+    return;
+  case LBC_CALL:
+  case LBC_TAILCALL: {
+    int n = in->arg;
+    int base = d - n - 1;
+    lval *f = fns[sites[base]];
+    if (f) {
+      ljit_load(b, base + 1);
+      LJIT_EMIT(b, "\x48\x8B\x8C\x24");
+      ljit_emit32(b, 8 * (base + 2));
+      ljit_op(b, f->op);
+      if (in->op == LBC_CALL) {
+        ljit_store(b, base);
+        return;
+      }
+      /* mov [r12], rax; mov eax, 1 */
+      LJIT_EMIT(b, "\x49\x89\x04\x24\xB8\x01\x00\x00\x00");
+      ljit_jump(b, LJIT_EXIT);
+      return;
+    }
+    if (in->op == LBC_CALL) {
+      /* lea rdi, [args]; lea rsi, [result]; lea edx, [r13 + 1] */
+      LJIT_EMIT(b, "\x48\x8D\xBC\x24");
+      ljit_emit32(b, 8 * (base + 1));
+      LJIT_EMIT(b, "\x48\x8D\xB4\x24");
+      ljit_emit32(b, 8 * base);
+      LJIT_EMIT(b, "\x41\x8D\x55\x01\xE8");
+      ljit_label(b, LJIT_START);
+      LJIT_EMIT(b, "\x85\xC0");
+      ljit_jump_if(b, 0, LJIT_DEOPT);
+      return;
+    }
+    /* Calls of itself in tail position restart with new arguments, unless
+     * the evaluation was interrupted */
+    LJIT_EMIT(b, "\x48\xB8");
+    ljit_emit64(b, (long)&linterrupted);
+    LJIT_EMIT(b, "\x83\x38\x00");
+    ljit_jump_if(b, 1, LJIT_DEOPT);
+    for (int j = 0; j < n; j++) {
+      ljit_load(b, base + 1 + j);
+      LJIT_EMIT(b, "\x48\x89\x83");
+      ljit_emit32(b, 8 * j);
+    }
+    ljit_jump(b, LJIT_BODY);
+    return;
+  }
+  case LBC_BRANCH:
+    ljit_load(b, d - 1);
+    LJIT_EMIT(b, "\x48\x85\xC0");
+    ljit_jump_if(b, 0, in->arg);
+    return;
+  case LBC_JUMP:
+    ljit_jump(b, in->arg);
+    return;
+  case LBC_AND:
+  case LBC_OR:
+    /* The operand is popped when it does not decide the result */
+    ljit_load(b, d - 1);
+    LJIT_EMIT(b, "\x48\x85\xC0");
+    ljit_jump_if(b, in->op == LBC_AND, i + 1);
+    LJIT_EMIT(b, "\x48\xC7\x84\x24");
+    ljit_emit32(b, 8 * (d - 1));
+    ljit_emit32(b, in->op == LBC_OR);
+    ljit_jump(b, in->arg);
+    return;
+  case LBC_RETURN:
+    ljit_load(b, d - 1);
+    LJIT_EMIT(b, "\x49\x89\x04\x24\xB8\x01\x00\x00\x00");
+    ljit_jump(b, LJIT_EXIT);
+    return;
+  }
+}
+
+/* Compile kernel 'c' for the functions 'fns' its sites call. The code is
+ * called with the arguments, where to put the result and the depth of the
+ * call, and returns 0 to deoptimize like lkern_run. */
+void ljit_compile(lcode *c, lval **fns) {
+  int size = c->stack + 1;
+  int *depths = malloc(sizeof(int) * c->count);
+  int *stacks = malloc(sizeof(int) * c->count * size);
+  if (!ljit_flow(c, fns, depths, stacks)) {
+    free(depths);
+    free(stacks);
+    return;
+  }
+
+  ljit_buf b = {NULL, 0, 0, 0, NULL};
+  int *labels = malloc(sizeof(int) * c->count);
+  int frame = (8 * size + 15) / 16 * 16;
+  /* push rbp; mov rbp, rsp; push rbx; push r12; push r13; push r14, which
+   * keeps the stack aligned; sub rsp, frame */
+  LJIT_EMIT(&b, "\x55\x48\x89\xE5\x53\x41\x54\x41\x55\x41\x56\x48\x81\xEC");
+  ljit_emit32(&b, frame);
+  /* rbx: arguments, r12: result, r13: depth; lkern_room(depth) */
+  LJIT_EMIT(&b, "\x48\x89\xFB\x49\x89\xF4\x41\x89\xD5\x89\xD7\x48\xB8");
+  ljit_emit64(&b, (long)&lkern_room);
+  LJIT_EMIT(&b, "\xFF\xD0\x85\xC0");
+  ljit_jump_if(&b, 0, LJIT_DEOPT);
+  int body = b.count;
+
+  /* Instructions falling through are followed by the next one, which is
+   * always reached */
+  for (int i = 0; i < c->count; i++) {
+    labels[i] = b.count;
+    if (depths[i] >= 0) {
+      ljit_instr(&b, c, fns, i, depths[i], stacks + i * size);
+    }
+  }
+  int deopt = b.count;
+  /* xor eax, eax; lea rsp, [rbp - 32]; pop r14; pop r13; pop r12; pop rbx;
+   * pop rbp; ret */
+  LJIT_EMIT(&b, "\x31\xC0");
+  int exit = b.count;
+  LJIT_EMIT(&b, "\x48\x8D\x65\xE0\x41\x5E\x41\x5D\x41\x5C\x5B\x5D\xC3");
+
+  for (int i = 0; i < b.fixups_count; i++) {
+    int at = b.fixups[2 * i];
+    int label = b.fixups[2 * i + 1];
+    int to = label == LJIT_START   ? 0
+             : label == LJIT_BODY  ? body
+             : label == LJIT_DEOPT ? deopt
+             : label == LJIT_EXIT  ? exit
+                                   : labels[label];
+    int rel = to - (at + 4);
+    memcpy(b.bytes + at, &rel, 4);
+  }
+
+  void *code = mmap(NULL, b.count, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code != MAP_FAILED) {
+    memcpy(code, b.bytes, b.count);
+    if (mprotect(code, b.count, PROT_READ | PROT_EXEC) == 0) {
+      c->jit = (ljit_fn)code;
+      c->jit_size = b.count;
+      c->jit_ops = malloc(sizeof(int) * (c->sites_count + 1));
+      for (int i = 0; i < c->sites_count; i++) {
+        c->jit_ops[i] = fns[i] ? fns[i]->op : -1;
+      }
+    } else {
+      munmap(code, b.count);
+    }
+  }
+  free(b.bytes);
+  free(b.fixups);
+  free(labels);
+  free(depths);
+  free(stacks);
+}
+
+/* Count a call of kernel 'c' with the functions 'fns', compiling it once
+ * it was called often enough. Returns whether there is native code for
+ * these functions. */
+int ljit_ready(lcode *c, lval **fns) {
+  if (!c->jit_tried && ljit_threshold > 0 && ++c->calls >= ljit_threshold) {
+    c->jit_tried = 1;
+    ljit_compile(c, fns);
+  }
+  if (!c->jit) {
+    return 0;
+  }
+  for (int i = 0; i < c->sites_count; i++) {
+    if (c->jit_ops[i] != (fns[i] ? fns[i]->op : -1)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+#endif
+
+/* Run kernel 'c' calling 'fns' on 'args', 'depth' calls below the one
+ * entered from the VM. Returns 0 to deoptimize. */
+int lkern_run(lcode *c, lval **fns, long *args, long *out, int depth) {
+#if LJIT
+  if (ljit_ready(c, fns)) {
+    return c->jit(args, out, depth);
+  }
+#endif
+  if (!lkern_room(depth)) {
+    return 0;
+  }
+  /* Values on the stack, and which of them are sites standing for the
+   * function called there */
+  long stack[c->stack + 1];
+  char site[c->stack + 1];
+  int sp = 0;
+  linstr *in = c->instrs;
+  while (1) {
+    switch (in->op) {
+    case LBC_CONST:
+      site[sp] = 0;
+      stack[sp++] = c->consts[in->arg]->num;
+      in++;
+      break;
+    case LBC_LOCAL:
+    case LBC_MOVE:
+      site[sp] = 0;
+      stack[sp++] = args[in->arg];
+      in++;
+      break;
+    case LBC_GLOBAL:
+      site[sp] = 1;
+      stack[sp++] = in->arg;
+      in++;
+      break;
+    case LBC_FOLD:
+      if (lfold_intact) {
+        site[sp] = 0;
+        stack[sp++] = c->consts[in->arg]->num;
+        in = c->instrs + in[1].arg;
+      } else {
+        in += 2;
+      }
+      break;
+    case LBC_FORM:
+      in += 2;
+      break;
+    case LBC_BINOP:
+    case LBC_TEST: {
+      long r;
+      if (!fns[in->arg]) {
+        site[sp] = 1;
+        stack[sp++] = in->arg;
+        in++;
+        break;
+      }
+      if (!lvm_binop(fns[in->arg], LKERN_OPERAND(c, in + 1, args),
+                     LKERN_OPERAND(c, in + 2, args), &r)) {
+        return 0;
+      }
+      if (in->op == LBC_BINOP) {
+        site[sp] = 0;
+        stack[sp++] = r;
+        in += 4;
+      } else {
+        in = r ? in + 5 : c->instrs + in[4].arg;
+      }
+      break;
+    }
+    case LBC_CALL:
+    case LBC_TAILCALL: {
+      int n = in->arg;
+      sp -= n + 1;
+      if (!site[sp]) {
+        return 0;
+      }
+      long *a = stack + sp + 1;
+      lval *f = fns[stack[sp]];
+      long r;
+      if (f) {
+        if (!lvm_binop(f, a[0], a[1], &r)) {
+          return 0;
+        }
+      } else if (in->op == LBC_TAILCALL) {
+        /* Calls of itself in tail position restart with new arguments */
+        if (linterrupted) {
+          return 0;
+        }
+        memcpy(args, a, sizeof(long) * n);
+#if LJIT
+        if (ljit_ready(c, fns)) {
+          return c->jit(args, out, depth);
+        }
+#endif
+        sp = 0;
+        in = c->instrs;
+        break;
+      } else if (!lkern_run(c, fns, a, &r, depth + 1)) {
+        return 0;
+      }
+      if (in->op == LBC_TAILCALL) {
+        *out = r;
+        return 1;
+      }
+      site[sp] = 0;
+      stack[sp++] = r;
+      in++;
+      break;
+    }
+    case LBC_BRANCH:
+      in = stack[--sp] ? in + 1 : c->instrs + in->arg;
+      break;
+    case LBC_JUMP:
+      in = c->instrs + in->arg;
+      break;
+    case LBC_AND:
+    case LBC_OR: {
+      int stop = in->op == LBC_OR;
+      if (!stack[--sp] != !stop) {
+        in++;
+        break;
+      }
+      site[sp] = 0;
+      stack[sp++] = stop;
+      in = c->instrs + in->arg;
+      break;
+    }
+    case LBC_RETURN:
+      *out = stack[sp - 1];
+      return 1;
+    default:
+      return 0;
+    }
+  }
+}
+
+/* Result of calling compiled lambda 'f' from 'e' with the 'n' values
+ * 'args' as a kernel, or NULL when the call must be made with the
+ * bytecode. Kernels are made of lambdas after a few calls with Numbers,
+ * and never of lambdas called with other types. */
+lval *lkern_call(lenv *e, lval *f, lval **args, int n) {
+  lcode *c = f->code;
+  if (!lkern_enabled || !lform_intact || c->kernel == LKERN_OFF ||
+      n != c->nargs || f->env->count) {
+    return NULL;
+  }
+  long a[n + 1];
+  for (int i = 0; i < n; i++) {
+    if (args[i]->type != LVAL_NUM) {
+      if (c->kernel == LKERN_PROFILE) {
+        c->kernel = LKERN_OFF;
+      }
+      return NULL;
+    }
+    a[i] = args[i]->num;
+  }
+  if (c->kernel == LKERN_PROFILE) {
+    if (++c->calls < LKERN_CALLS) {
+      return NULL;
+    }
+    c->kernel = lkern_check(c) ? LKERN_ON : LKERN_OFF;
+  }
+
+  lval *fns[c->sites_count + 1];
+  long r;
+  if (c->kernel != LKERN_ON || !lkern_resolve(e, c, fns)) {
+    c->kernel = LKERN_OFF;
+    return NULL;
+  }
+  if (!lkern_run(c, fns, a, &r, 0)) {
+    c->kernel = LKERN_OFF;
+    return NULL;
+  }
+  return lval_num(r);
+}
+
+/* Value pushed by the LOCAL or CONST instruction 'in', without copying */
+#define LVM_OPERAND(fr, in)                                                    \
+  ((in)->op == LBC_LOCAL ? (fr).env->vals[(in)->arg]                           \
+                         : (fr).code->consts[(in)->arg])
+
+/* Instruction dispatch: threaded code jumps straight to the next handler,
+ * otherwise a switch is used */
+#if LVM_THREADED
+#define LVM_CASE(op) L_##op:
+#define LVM_NEXT()                                                             \
+  in = fr.ip++;                                                                \
+  goto *in->label
+#define LVM_LABEL(op) [op] = &&L_##op
+#else
+#define LVM_CASE(op) case op:
+#define LVM_NEXT() break
+#endif
+
+/* Run the bytecode 'c' of a function whose arguments are bound in 'e' */
+lval *lvm_run(lenv *e, lcode *c) {
+  lval *x;
+  if ((x = lval_guard())) {
+    return x;
+  }
+
+#if LVM_THREADED
+  static void *labels[] = {
+      LVM_LABEL(LBC_CONST),  LVM_LABEL(LBC_LOCAL),    LVM_LABEL(LBC_GLOBAL),
+      LVM_LABEL(LBC_CALL),   LVM_LABEL(LBC_TAILCALL), LVM_LABEL(LBC_BRANCH),
+      LVM_LABEL(LBC_JUMP),   LVM_LABEL(LBC_RETURN),   LVM_LABEL(LBC_BINOP),
+      LVM_LABEL(LBC_TEST),   LVM_LABEL(LBC_AND),      LVM_LABEL(LBC_OR),
+      LVM_LABEL(LBC_LAMBDA), LVM_LABEL(LBC_FOLD),     LVM_LABEL(LBC_FORM),
+      LVM_LABEL(LBC_LOOP),   LVM_LABEL(LBC_TIMES),    LVM_LABEL(LBC_EACH),
+      LVM_LABEL(LBC_PUT),    LVM_LABEL(LBC_UNWIND),   LVM_LABEL(LBC_SET),
+      LVM_LABEL(LBC_PIPE),   LVM_LABEL(LBC_MOVE),     LVM_LABEL(LBC_WHILE),
+      LVM_LABEL(LBC_SAVE),   LVM_LABEL(LBC_RESTORE)};
+/* Fill in handler addresses the first time code runs */
+#define LVM_THREAD(code)                                                       \
+  if (!(code)->threaded) {                                                     \
+    for (int i = 0; i < (code)->count; i++) {                                  \
+      (code)->instrs[i].label = labels[(code)->instrs[i].op];                  \
+    }                                                                          \
+    (code)->threaded = 1;                                                      \
+  }
+#else
+#define LVM_THREAD(code)
+#endif
+
+  int cap = c->stack;
+  lval **stack = malloc(sizeof(lval *) * cap);
+  int sp = 0;
+
+  int frames_cap = 0;
+  int frames_count = 0;
+  lframe *frames = NULL;
+  lframe fr = {c, c->instrs, e, NULL, 0, {0, NULL}, NULL, NULL};
+  linstr *in;
+  LVM_THREAD(c);
+
+#if LVM_THREADED
+  LVM_NEXT();
+#else
+  while (1) {
+    in = fr.ip++;
+    switch (in->op) {
+#endif
+
+  LVM_CASE(LBC_CONST) {
+    stack[sp++] = lval_copy(fr.code->consts[in->arg]);
+    LVM_NEXT();
+  }
+  LVM_CASE(LBC_LOCAL) {
+    stack[sp++] = lval_copy(fr.env->vals[in->arg]);
+    LVM_NEXT();
+  }
+  LVM_CASE(LBC_MOVE) {
+    /* The function called in tail position is at the base */
+    stack[sp++] = lval_pass(fr.env, in->arg, stack[fr.base]);
+    LVM_NEXT();
+  }
+  LVM_CASE(LBC_GLOBAL) {
+    stack[sp++] = lvm_site_get(fr.env, fr.code, &fr.code->sites[in->arg]);
+    LVM_NEXT();
+  }
+  LVM_CASE(LBC_BINOP) {
+    lsite *site = &fr.code->sites[in->arg];
+    lval *f = lvm_site_ref(fr.env, fr.code, site);
+    lval *a = LVM_OPERAND(fr, in + 1);
+    lval *b = LVM_OPERAND(fr, in + 2);
+    long r;
+    if (a->type == LVAL_NUM && b->type == LVAL_NUM &&
+        lvm_binop(f, a->num, b->num, &r)) {
+      stack[sp++] = lval_num(r);
+      fr.ip = in + 4;
+    } else {
+      /* Slow path: the sequence after this instruction */
+      stack[sp++] = lvm_site_get(fr.env, fr.code, site);
+    }
+    LVM_NEXT();
+  }
+  LVM_CASE(LBC_TEST) {
+    lsite *site = &fr.code->sites[in->arg];
+    lval *f = lvm_site_ref(fr.env, fr.code, site);
+    lval *a = LVM_OPERAND(fr, in + 1);
+    lval *b = LVM_OPERAND(fr, in + 2);
+    long r;
+    if (a->type == LVAL_NUM && b->type == LVAL_NUM &&
+        lvm_binop(f, a->num, b->num, &r)) {
+      fr.ip = r ? in + 5 : fr.code->instrs + in[4].arg;
+    } else {
+      stack[sp++] = lvm_site_get(fr.env, fr.code, site);
+    }
+    LVM_NEXT();
+  }
+  LVM_CASE(LBC_CALL) {
+    int n = in->arg;
+    sp -= n + 1;
+    lval *f = stack[sp];
+    if ((x = lvm_check(stack + sp, n))) {
+      stack[sp++] = x;
+      LVM_NEXT();
+    }
+
+    /* Arithmetic on Numbers is computed in place */
+    long r;
+    if (n == 2 && stack[sp + 1]->type == LVAL_NUM &&
+        stack[sp + 2]->type == LVAL_NUM &&
+        lvm_binop(f, stack[sp + 1]->num, stack[sp + 2]->num, &r)) {
+      for (int i = 0; i < 3; i++) {
+        lval_del(stack[sp + i]);
+      }
+      stack[sp++] = lval_num(r);
+      LVM_NEXT();
+    }
+
+    /* Memoized compiled lambdas missing in their table are entered like
+     * the others, so that recursion through them stays off the C stack,
+     * and the result is remembered when they return */
+    lmemo *memo = NULL;
+    lval *key = NULL;
+    if (f->memo && !f->memo->f->builtin && f->memo->f->code) {
+      key = lvm_args(stack + sp + 1, n);
+      if ((x = lmemo_get(f->memo, key))) {
+        lval_del(key);
+        lval_del(f);
+        stack[sp++] = x;
+        LVM_NEXT();
+      }
+      memo = f->memo;
+      memo->refs++;
+      stack[sp] = lval_copy(memo->f);
+      lval_del(f);
+      f = stack[sp];
+      for (int i = 0; i < n; i++) {
+        stack[sp + 1 + i] = lval_copy(key->cell[i]);
+      }
+    }
+
+    /* Other functions are called directly */
+    if (f->builtin || !f->code) {
+      stack[sp] = lvm_call(fr.env, stack + sp, n);
+      sp++;
+      LVM_NEXT();
+    }
+
+    if ((x = lkern_call(fr.env, f, stack + sp + 1, n))) {
+      for (int i = 0; i <= n; i++) {
+        lval_del(stack[sp + i]);
+      }
+      if (memo) {
+        lmemo_keep(memo, key, x);
+        lmemo_release(memo);
+      }
+      stack[sp++] = x;
+      LVM_NEXT();
+    }
+
+    if ((x = lval_bind(fr.env, f, lvm_args(stack + sp + 1, n))) ||
+        (x = lvm_guard())) {
+      lval_del(f);
+      if (memo) {
+        lmemo_keep(memo, key, x);
+        lmemo_release(memo);
+      }
+      stack[sp++] = x;
+      LVM_NEXT();
+    }
+
+    /* Suspend the caller and enter the compiled lambda */
+    if (frames_count == frames_cap) {
+      frames_cap = frames_cap ? frames_cap * 2 : 16;
+      frames = realloc(frames, sizeof(lframe) * frames_cap);
+    }
+    frames[frames_count++] = fr;
+    lvm_depth++;
+
+    lenv_link(f->env, fr.env);
+    fr.code = f->code;
+    fr.ip = f->code->instrs;
+    fr.env = f->env;
+    fr.fn = f;
+    fr.base = sp;
+    fr.tail.count = 0;
+    fr.tail.fns = NULL;
+    fr.memo = memo;
+    fr.key = key;
+    LVM_RESERVE(stack, cap, sp + fr.code->stack);
+    LVM_THREAD(fr.code);
+    LVM_NEXT();
+  }
+  LVM_CASE(LBC_TAILCALL) {
+    /* The call is all that is left in the frame */
+    int n = in->arg;
+    sp = fr.base;
+    while (1) {
+      lval **items = stack + sp;
+      lval *f = items[0];
+      if ((x = lvm_check(items, n)) || (x = lvm_guard())) {
+        break;
+      }
+
+      /* 'if' and 'eval' continue with the elements of their expression */
+      if (f->builtin && (f->op == LOP_IF || f->op == LOP_EVAL)) {
+        lval *a = lvm_args(items + 1, n);
+        lval *v = f->op == LOP_IF ? lval_if_branch(a) : lval_eval_expr(a);
+        lval_del(f);
+        if (v->type != LVAL_SEXPR || v->count < 2) {
+          x = lval_eval(fr.env, v);
+          break;
+        }
+        n = v->count - 1;
+        LVM_RESERVE(stack, cap, sp + v->count);
+        for (int i = 0; i < v->count; i++) {
+          stack[sp + i] = lval_eval(fr.env, v->cell[i]);
+        }
+        v->count = 0;
+        lval_del(v);
+        continue;
+      }
+
+      /* Partial applications given all they need continue with the call
+       * of their function */
+      if (f->partial && lpartial_full(f, n)) {
+        lval *a = lpartial_unfold(&f, lvm_args(items + 1, n));
+        n = a->count;
+        LVM_RESERVE(stack, cap, sp + n + 1);
+        stack[sp] = f;
+        memcpy(stack + sp + 1, a->cell, sizeof(lval *) * n);
+        a->count = 0;
+        lval_del(a);
+        continue;
+      }
+
+      /* Compiled lambdas replace the running function */
+      if (!f->builtin && f->code) {
+        if ((x = lkern_call(fr.env, f, items + 1, n))) {
+          for (int i = 0; i <= n; i++) {
+            lval_del(items[i]);
+          }
+          break;
+        }
+        if ((x = lval_bind(fr.env, f, lvm_args(items + 1, n)))) {
+          lval_del(f);
+          break;
+        }
+        ltail_enter(&fr.tail, f, fr.env);
+        fr.env = f->env;
+        fr.code = f->code;
+        fr.ip = f->code->instrs;
+        LVM_RESERVE(stack, cap, sp + fr.code->stack);
+        LVM_THREAD(fr.code);
+        x = NULL;
+        break;
+      }
+
+      x = lvm_call(fr.env, items, n);
+      break;
+    }
+    if (x) {
+      stack[sp++] = x;
+    }
+    LVM_NEXT();
+  }
+  LVM_CASE(LBC_BRANCH) {
+    lval *cond = stack[sp - 1];
+    if (cond->type == LVAL_NUM) {
+      sp--;
+      if (!cond->num) {
+        fr.ip = fr.code->instrs + in->arg;
+      }
+      lval_del(cond);
+      LVM_NEXT();
+    }
+    /* An invalid condition is the result of the whole 'if' */
+    if (cond->type != LVAL_ERR) {
+      stack[sp - 1] =
+          lval_err("Function '%s' passed incorrect type. Got %s, "
+                   "Expected %s.",
+                   "if", ltype_name(cond->type), ltype_name(LVAL_NUM));
+      lval_del(cond);
+    }
+    fr.ip = fr.code->instrs + fr.code->instrs[in->arg - 1].arg;
+    LVM_NEXT();
+  }
+  LVM_CASE(LBC_AND)
+  LVM_CASE(LBC_OR) {
+    lval *v = stack[sp - 1];
+    int stop = in->op == LBC_OR;
+    if (v->type == LVAL_NUM && !v->num != !stop) {
+      sp--;
+      lval_del(v);
+      LVM_NEXT();
+    }
+    if (v->type == LVAL_NUM) {
+      stack[sp - 1] = lval_num(stop);
+      lval_del(v);
+    } else if (v->type != LVAL_ERR) {
+      stack[sp - 1] =
+          lval_err("Function '%s' passed incorrect type. Got %s, "
+                   "Expected %s.",
+                   stop ? "||" : "&&", ltype_name(v->type),
+                   ltype_name(LVAL_NUM));
+      lval_del(v);
+    }
+    fr.ip = fr.code->instrs + in->arg;
+    LVM_NEXT();
+  }
+  LVM_CASE(LBC_LAMBDA) {
+    lval *f = lval_copy(fr.code->consts[in->arg]);
+    f->env->ns = lenv_ns(fr.env);
+    stack[sp++] = f;
+    LVM_NEXT();
+  }
+  LVM_CASE(LBC_FOLD) {
+    if (lfold_intact) {
+      stack[sp++] = lval_copy(fr.code->consts[in->arg]);
+      fr.ip = fr.code->instrs + in[1].arg;
+    } else {
+      fr.ip = in + 2;
+    }
+    LVM_NEXT();
+  }
+  LVM_CASE(LBC_FORM) {
+    if (lform_intact) {
+      fr.ip = in + 2;
+    } else {
+      stack[sp++] = lform_eval(fr.env, fr.code->consts[in->arg]);
+    }
+    LVM_NEXT();
+  }
+  LVM_CASE(LBC_WHILE) {
+    if ((x = lwhile_end(stack[--sp]))) {
+      stack[sp++] = x;
+      fr.ip = fr.code->instrs + in->arg;
+    }
+    LVM_NEXT();
+  }
+  LVM_CASE(LBC_LOOP) {
+    if (stack[sp - 1]->type == LVAL_ERR) {
+      LVM_NEXT();
+    }
+    lval_del(stack[--sp]);
+    if ((x = lval_guard())) {
+      stack[sp++] = x;
+    } else {
+      fr.ip = fr.code->instrs + in->arg;
+    }
+    LVM_NEXT();
+  }
+  LVM_CASE(LBC_TIMES)
+  LVM_CASE(LBC_EACH) {
+    lval *i = stack[sp - 1];
+    x = lloop_value(fr.env, in->op == LBC_TIMES ? LOP_DOTIMES : LOP_FOR_EACH,
+                    stack[sp - 2], i->num);
+    if (x && x->type != LVAL_ERR) {
+      i->num++;
+    } else {
+      x = x ? x : lval_sexpr();
+      fr.ip = fr.code->instrs + in->arg;
+    }
+    stack[sp++] = x;
+    LVM_NEXT();
+  }
+  LVM_CASE(LBC_PUT) {
+    lenv_bind(fr.env, fr.code->consts[in->arg]->sym, stack[--sp]);
+    LVM_NEXT();
+  }
+  LVM_CASE(LBC_UNWIND) {
+    x = stack[--sp];
+    for (int i = 0; i < in->arg; i++) {
+      lval_del(stack[--sp]);
+    }
+    stack[sp++] = x;
+    LVM_NEXT();
+  }
+  LVM_CASE(LBC_SAVE) {
+    x = stack[sp - 1];
+    stack[sp - 1] = lloop_save(fr.env, fr.code->consts[in->arg]->sym);
+    stack[sp++] = x;
+    LVM_NEXT();
+  }
+  LVM_CASE(LBC_RESTORE) {
+    x = stack[--sp];
+    lloop_restore(fr.env, fr.code->consts[in->arg]->sym, stack[sp - 1]);
+    stack[sp - 1] = x;
+    LVM_NEXT();
+  }
+  LVM_CASE(LBC_SET) {
+    lval *v = stack[sp - 1];
+    if (v->type != LVAL_ERR) {
+      x = lenv_set(fr.env, fr.code->consts[in->arg], v);
+      stack[sp - 1] = x ? x : lval_sexpr();
+    }
+    LVM_NEXT();
+  }
+  LVM_CASE(LBC_PIPE) {
+    lval *form = fr.code->consts[in->arg];
+    sp -= lpipe_items(form);
+    x = lpipe_call(fr.env, form, stack + sp);
+    stack[sp++] = x;
+    LVM_NEXT();
+  }
+  LVM_CASE(LBC_JUMP) {
+    fr.ip = fr.code->instrs + in->arg;
+    LVM_NEXT();
+  }
+  LVM_CASE(LBC_RETURN) {
+    x = stack[--sp];
+    ltail_exit(&fr.tail);
+    if (fr.fn) {
+      lval_del(fr.fn);
+    }
+    if (fr.memo) {
+      lmemo_keep(fr.memo, fr.key, x);
+      lmemo_release(fr.memo);
+    }
+
+    /* Returning from the function lvm_run was entered with */
+    if (frames_count == 0) {
+      free(stack);
+      free(frames);
+      return x;
+    }
+
+    /* Otherwise resume the caller with the result */
+    fr = frames[--frames_count];
+    lvm_depth--;
+    stack[sp++] = x;
+    LVM_NEXT();
+  }
+
+#if !LVM_THREADED
+    }
+  }
+#endif
+}
+
+/* Closure compilation: as an alternative to bytecode, a lambda body is
+ * turned into a tree of nodes, each run by a C function specialized for
+ * what the node evaluates */
+struct lnode {
+  lval *(*run)(lnode *n, lenv *e);
+  /* Argument slot of a local, whether a call is in tail position, or how
+   * many arguments a global is called with */
+  int arg;
+  /* Constant, or symbol to look up */
+  lval *val;
+  int count;
+  lnode **kids;
+  /* Copies of the lambda sharing the tree, counted on the root */
+  int refs;
+  /* Inline cache of a symbol lookup */
+  lcache cache;
+};
+
+/* Result of a call in tail position, made by the enclosing lnode_enter
+ * with the function and arguments left here */
+lval lnode_pending;
+lval *lnode_tail_fn;
+lval *lnode_tail_args;
+
+/* Calls with up to this many elements keep them on the C stack */
+#define LNODE_ITEMS 8
+
+lnode *lnode_new(lval *(*run)(lnode *, lenv *), int arg, lval *val) {
+  lnode *n = malloc(sizeof(lnode));
+  n->run = run;
+  n->arg = arg;
+  n->val = val;
+  n->count = 0;
+  n->kids = NULL;
+  n->refs = 1;
+  n->cache.env = NULL;
+  n->cache.slot = 0;
+  return n;
+}
+
+lnode *lnode_add(lnode *n, lnode *kid) {
+  n->count++;
+  n->kids = realloc(n->kids, sizeof(lnode *) * n->count);
+  n->kids[n->count - 1] = kid;
+  return n;
+}
+
+void lnode_del(lnode *n) {
+  if (n->val) {
+    lval_del(n->val);
+  }
+  for (int i = 0; i < n->count; i++) {
+    lnode_del(n->kids[i]);
+  }
+  free(n->kids);
+  free(n);
+}
+
+lnode *lnode_retain(lnode *n) {
+  n->refs++;
+  return n;
+}
+
+void lnode_release(lnode *n) {
+  if (--n->refs == 0) {
+    lnode_del(n);
+  }
+}
+
+lval *lnode_const(lnode *n, lenv *e) { return lval_copy(n->val); }
+
+lval *lnode_local(lnode *n, lenv *e) { return lval_copy(e->vals[n->arg]); }
+
+/* Argument of a call in tail position, passed by lnode_call */
+lval *lnode_move(lnode *n, lenv *e) { return lval_copy(e->vals[n->arg]); }
+
+/* Symbol 'val' called with 'arg' arguments, or -1 */
+lval *lnode_global(lnode *n, lenv *e) {
+  return lenv_callee(e, n->val, &n->cache, n->arg);
+}
+
+lval *lnode_if(lnode *n, lenv *e) {
+  lval *cond = n->kids[0]->run(n->kids[0], e);
+  if (cond->type == LVAL_NUM) {
+    lnode *branch = cond->num ? n->kids[1] : n->kids[2];
+    lval_del(cond);
+    return branch->run(branch, e);
+  }
+  if (cond->type == LVAL_ERR) {
+    return cond;
+  }
+  lval *err = lval_err("Function '%s' passed incorrect type. Got %s, "
+                       "Expected %s.",
+                       "if", ltype_name(cond->type), ltype_name(LVAL_NUM));
+  lval_del(cond);
+  return err;
+}
+
+/* '&&' or '||', stopping at the first operand deciding the result */
+lval *lnode_bool(lnode *n, lenv *e) {
+  int stop = n->arg == LOP_OR;
+  for (int i = 0; i < n->count; i++) {
+    lval *v = n->kids[i]->run(n->kids[i], e);
+    if (v->type == LVAL_ERR) {
+      return v;
+    }
+    if (v->type != LVAL_NUM) {
+      lval *err = lval_err("Function '%s' passed incorrect type. Got %s, "
+                           "Expected %s.",
+                           lbuiltins[n->arg].name, ltype_name(v->type),
+                           ltype_name(LVAL_NUM));
+      lval_del(v);
+      return err;
+    }
+    int decides = !v->num == !stop;
+    lval_del(v);
+    if (decides) {
+      return lval_num(stop);
+    }
+  }
+  return lval_num(!stop);
+}
+
+/* Special form 'val' compiled inline, see LBC_FORM */
+lval *lnode_form(lnode *n, lenv *e) {
+  if (lform_intact) {
+    return n->kids[0]->run(n->kids[0], e);
+  }
+  return lform_eval(e, n->val);
+}
+
+lval *lnode_fold(lnode *n, lenv *e) {
+  if (lfold_intact) {
+    return lval_copy(n->val);
+  }
+  return n->kids[0]->run(n->kids[0], e);
+}
+
+lval *lnode_while(lnode *n, lenv *e) {
+  lval *x;
+  while (!(x = lval_guard()) &&
+         !(x = lwhile_end(n->kids[0]->run(n->kids[0], e)))) {
+    lval *r = n->kids[1]->run(n->kids[1], e);
+    if (r->type == LVAL_ERR) {
+      return r;
+    }
+    lval_del(r);
+  }
+  return x;
+}
+
+/* 'dotimes' or 'for-each' binding symbol 'val' */
+lval *lnode_loop(lnode *n, lenv *e) {
+  lval *l = n->kids[0]->run(n->kids[0], e);
+  lval *saved = lloop_save(e, n->val->sym);
+  lval *x;
+  for (long i = 0; !(x = lval_guard()); i++) {
+    lval *v = lloop_value(e, n->arg, l, i);
+    if (!v || v->type == LVAL_ERR) {
+      x = v ? v : lval_sexpr();
+      break;
+    }
+    lenv_bind(e, n->val->sym, v);
+
+    lval *r = n->kids[1]->run(n->kids[1], e);
+    if (r->type == LVAL_ERR) {
+      x = r;
+      break;
+    }
+    lval_del(r);
+  }
+  lloop_restore(e, n->val->sym, saved);
+  lval_del(l);
+  return x;
+}
+
+lval *lnode_set(lnode *n, lenv *e) {
+  lval *v = n->kids[0]->run(n->kids[0], e);
+  if (v->type == LVAL_ERR) {
+    return v;
+  }
+  lval *x = lenv_set(e, n->val, v);
+  return x ? x : lval_sexpr();
+}
+
+/* A chain of list functions, its elements the kids */
+lval *lnode_pipe(lnode *n, lenv *e) {
+  lval *items[LPIPE_ITEMS];
+  for (int i = 0; i < n->count; i++) {
+    items[i] = n->kids[i]->run(n->kids[i], e);
+  }
+  return lpipe_call(e, n->val, items);
+}
+
+lval *lnode_lambda(lnode *n, lenv *e) {
+  lval *f = lval_copy(n->val);
+  f->env->ns = lenv_ns(e);
+  return f;
+}
+
+/* Call items[0] with the 'n' evaluated arguments after it. In tail
+ * position calls to closure compiled lambdas are left to lnode_enter. */
+lval *lnode_apply(lenv *e, lval **items, int n, int tail) {
+  lval *x;
+  if ((x = lvm_check(items, n))) {
+    return x;
+  }
+
+  lval *f = items[0];
+  lval *a = lvm_args(items + 1, n);
+  if (tail && f->partial && lpartial_full(f, n)) {
+    a = lpartial_unfold(&f, a);
+  }
+  if (tail && !f->builtin && f->node) {
+    lnode_tail_fn = f;
+    lnode_tail_args = a;
+    return &lnode_pending;
+  }
+
+  x = lval_call(e, f, a);
+  lval_del(f);
+  return x;
+}
+
+lval *lnode_call(lnode *n, lenv *e) {
+  lval *small[LNODE_ITEMS];
+  lval **items = n->count <= LNODE_ITEMS ? small
+                                         : malloc(sizeof(lval *) * n->count);
+  for (int i = 0; i < n->count; i++) {
+    lnode *kid = n->kids[i];
+    items[i] = kid->run == lnode_move ? lval_pass(e, kid->arg, items[0])
+                                      : kid->run(kid, e);
+  }
+  lval *x = lnode_apply(e, items, n->count - 1, n->arg);
+  if (items != small) {
+    free(items);
+  }
+  return x;
+}
+
+/* The value bound to the symbol of global 'n' without copying it, or NULL */
+lval *lnode_ref(lnode *n, lenv *e) {
+  lval **slot = lenv_cached(e, n->val, &n->cache);
+  return slot ? *slot : NULL;
+}
+
+/* Call global 'g' with operands 'x' and 'y', directly when it is an
+ * arithmetic or comparison builtin on Numbers */
+lval *lnode_binop(lnode *g, lenv *e, lval *x, lval *y, int tail) {
+  long r;
+  if (x->type == LVAL_NUM && y->type == LVAL_NUM &&
+      lvm_binop(lnode_ref(g, e), x->num, y->num, &r)) {
+    lval_del(x);
+    lval_del(y);
+    return lval_num(r);
+  }
+
+  lval *items[3] = {g->run(g, e), x, y};
+  return lnode_apply(e, items, 2, tail);
+}
+
+/* A call of a global with two operands free of side effects */
+lval *lnode_arith(lnode *n, lenv *e) {
+  lval *x = n->kids[1]->run(n->kids[1], e);
+  lval *y = n->kids[2]->run(n->kids[2], e);
+  return lnode_binop(n->kids[0], e, x, y, n->arg);
+}
+
+/* Run the tree of lambda 'f', whose formals are bound, looping over calls
+ * it makes in tail position */
+lval *lnode_enter(lval *f) {
+  lval *x;
+  if ((x = lvm_guard())) {
+    return x;
+  }
+  lvm_depth++;
+
+  ltail t = {0, NULL};
+  lenv *e = f->env;
+  lnode *body = f->node;
+  while ((x = body->run(body, e)) == &lnode_pending) {
+    lval *g = lnode_tail_fn;
+    if ((x = lval_guard())) {
+      lval_del(lnode_tail_args);
+    }
+    if (x || (x = lval_bind(e, g, lnode_tail_args))) {
+      lval_del(g);
+      break;
+    }
+    ltail_enter(&t, g, e);
+    e = g->env;
+    body = g->node;
+  }
+
+  ltail_exit(&t);
+  lvm_depth--;
+  return x;
+}
+
+lnode *lnode_compile_expr(lcompiler *c, lval *x, int tail);
+
+/* Whether evaluating 'x' has no effects, so operands may be evaluated in
+ * any order */
+int lnode_is_operand(lval *x) { return x->type != LVAL_SEXPR; }
+
+lnode *lnode_compile_sexpr(lcompiler *c, lval *x, int tail);
+
+/* Compile the special form 'x' of builtin 'op' inline */
+lnode *lnode_compile_inline(lcompiler *c, lval *x, int op, int tail) {
+
+  /* 'if' only runs the branch taken */
+  if (op == LOP_IF) {
+    lnode *n = lnode_new(lnode_if, 0, NULL);
+    lnode_add(n, lnode_compile_expr(c, x->cell[1], 0));
+    lnode_add(n, lnode_compile_sexpr(c, x->cell[2], tail));
+    return lnode_add(n, lnode_compile_sexpr(c, x->cell[3], tail));
+  }
+
+  /* '&&' and '||' only evaluate operands until the result is decided */
+  if (op == LOP_AND || op == LOP_OR) {
+    lnode *n = lnode_new(lnode_bool, op, NULL);
+    for (int i = 1; i < x->count; i++) {
+      lnode_add(n, lnode_compile_expr(c, x->cell[i], 0));
+    }
+    return n;
+  }
+
+  /* Loops and 'set!', see lcomp_inline */
+  if (op == LOP_WHILE) {
+    lnode *n = lnode_new(lnode_while, 0, NULL);
+    lnode_add(n, lnode_compile_sexpr(c, x->cell[1], 0));
+    return lnode_add(n, lnode_compile_sexpr(c, x->cell[2], 0));
+  }
+  lval *sym = x->cell[1]->cell[0];
+  lfold_forget(sym->sym);
+  lnode *n = op == LOP_SET ? lnode_new(lnode_set, 0, lval_copy(sym))
+                           : lnode_new(lnode_loop, op, lval_copy(sym));
+  lnode_add(n, lnode_compile_expr(c, x->cell[2], 0));
+  if (op != LOP_SET) {
+    lnode_add(n, lnode_compile_sexpr(c, x->cell[3], 0));
+  }
+  return n;
+}
+
+lnode *lnode_compile_sexpr(lcompiler *c, lval *x, int tail) {
+
+  /* Empty Expression */
+  if (x->count == 0) {
+    return lnode_new(lnode_const, 0, lval_sexpr());
+  }
+
+  /* Single Expression */
+  if (x->count == 1) {
+    return lnode_compile_expr(c, x->cell[0], tail);
+  }
+
+  /* 'if' with literal branches, '&&', '||', loops and 'set!', guarded like
+   * in lcomp_sexpr */
+  int op = lcomp_form(c, x);
+  if (op >= 0) {
+    return lnode_add(lnode_new(lnode_form, 0, lval_copy(x)),
+                     lnode_compile_inline(c, x, op, tail));
+  }
+
+  /* Constant calls of pure builtins are computed once, see lcomp_sexpr */
+  lval *v = lfold_call(c, x);
+  if (v) {
+    c->fold = 0;
+    lnode *n = lnode_add(lnode_new(lnode_fold, 0, v),
+                         lnode_compile_sexpr(c, x, tail));
+    c->fold = 1;
+    return n;
+  }
+
+  /* Chains of list functions, see lpipe_call */
+  int stages = lpipe_stages(x);
+  if (stages) {
+    lnode *n = lnode_new(lnode_pipe, 0, lval_copy(x));
+    for (int i = 0; i < stages; i++) {
+      lval *s = lpipe_stage(x, i);
+      for (int j = 0; j < s->count - 1; j++) {
+        lnode_add(n, lnode_compile_expr(c, s->cell[j], 0));
+      }
+    }
+    return lnode_add(n, lnode_compile_expr(c, lpipe_stage(x, stages), 0));
+  }
+
+  /* Lambdas with literal bodies are compiled once with the function */
+  if (lcomp_is_lambda(c, x)) {
+    lval *f = lval_lambda(lval_copy(x->cell[1]), lval_copy(x->cell[2]));
+    f->node = lnode_compile(f->formals, f->body);
+    return lnode_new(lnode_lambda, 0, f);
+  }
+
+  /* Operators applied to simple operands */
+  if (x->count == 3 && x->cell[0]->type == LVAL_SYM &&
+      lcomp_slot(c, x->cell[0]->sym) == -1 && lnode_is_operand(x->cell[1]) &&
+      lnode_is_operand(x->cell[2])) {
+    lnode *n = lnode_new(lnode_arith, tail, NULL);
+    for (int i = 0; i < 3; i++) {
+      lnode_add(n, lnode_compile_expr(c, x->cell[i], 0));
+    }
+    n->kids[0]->arg = 2;
+    return n;
+  }
+
+  /* Otherwise evaluate every element and call the first */
+  lnode *n = lnode_new(lnode_call, tail, NULL);
+  for (int i = 0; i < x->count; i++) {
+    if (i > 0 && tail && lcomp_passes(c, x, i)) {
+      int slot = lcomp_slot(c, x->cell[i]->sym);
+      lnode_add(n, lnode_new(lnode_move, slot, NULL));
+    } else {
+      lnode_add(n, lnode_compile_expr(c, x->cell[i], 0));
+    }
+  }
+  if (n->kids[0]->run == lnode_global) {
+    n->kids[0]->arg = x->count - 1;
+  }
+  return n;
+}
+
+lnode *lnode_compile_expr(lcompiler *c, lval *x, int tail) {
+  switch (x->type) {
+  case LVAL_SYM: {
+    int slot = lcomp_slot(c, x->sym);
+    if (slot >= 0) {
+      return lnode_new(lnode_local, slot, NULL);
+    }
+    return lnode_new(lnode_global, -1, lval_copy(x));
+  }
+  case LVAL_SEXPR:
+    return lnode_compile_sexpr(c, x, tail);
+  /* All other lval types evaluate to themselves */
+  default:
+    return lnode_new(lnode_const, 0, lval_copy(x));
+  }
+}
+
+/* Compile a lambda body to a tree of closures, using the argument slots of
+ * the bytecode compiler */
+lnode *lnode_compile(lval *formals, lval *body) {
+  lcompiler c;
+  c.code = NULL;
+  c.formals = formals;
+  c.no_slots = lcomp_has_duplicates(formals);
+  c.depth = 0;
+  c.fold = 1;
+
+  lfold_forget_formals(formals);
+  return lnode_compile_sexpr(&c, body, 1);
+}
+
+/* Ahead-of-time compilation: 'mlisp --compile-c file' writes C source
+ * running the program in 'file' on this runtime. Every expression is
+ * evaluated in order as when loading the file, and lambdas defined with
+ * 'fun' or 'def' at the top level are compiled like closure compilation,
+ * each node written as C code, and installed as the tree of the lambda by
+ * laot_install. */
+
+/* Text written by the compiler */
+typedef struct {
+  char *s;
+  int len;
+  int cap;
+} laot_buf;
+
+void laot_vprintf(laot_buf *b, char *fmt, va_list va) {
+  va_list again;
+  va_copy(again, va);
+  int n = vsnprintf(NULL, 0, fmt, va);
+  if (b->len + n + 1 > b->cap) {
+    b->cap = b->cap * 2 + n + 1;
+    b->s = realloc(b->s, b->cap);
+  }
+  vsnprintf(b->s + b->len, n + 1, fmt, again);
+  va_end(again);
+  b->len += n;
+}
+
+void laot_printf(laot_buf *b, char *fmt, ...) {
+  va_list va;
+  va_start(va, fmt);
+  laot_vprintf(b, fmt, va);
+  va_end(va);
+}
+
+/* C string literal of 's', with '?' escaped so no trigraph is formed */
+void laot_string(laot_buf *b, char *s) {
+  laot_printf(b, "\"");
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\' || *s == '?' || *s < ' ' || *s > '~') {
+      laot_printf(b, "\\%03o", (unsigned char)*s);
+    } else {
+      laot_printf(b, "%c", *s);
+    }
+  }
+  laot_printf(b, "\"");
+}
+
+/* C expression constructing the read value 'v' */
+void laot_value(laot_buf *b, lval *v) {
+  switch (v->type) {
+  case LVAL_NUM:
+    laot_printf(b, "lval_num(%liL)", v->num);
+    return;
+  case LVAL_SYM:
+    laot_printf(b, "lval_sym(");
+    laot_string(b, v->sym);
+    laot_printf(b, ")");
+    return;
+  case LVAL_STR:
+    laot_printf(b, "lval_str(");
+    laot_string(b, v->str);
+    laot_printf(b, ")");
+    return;
+  default:
+    laot_printf(b, "laot_expr(%i, %i", v->type == LVAL_QEXPR, v->count);
+    for (int i = 0; i < v->count; i++) {
+      laot_printf(b, ", ");
+      laot_value(b, v->cell[i]);
+    }
+    laot_printf(b, ")");
   }
+}
 
-  /* Error Checking */
-  for (int i = 0; i < v->count; i++) {
-    if (v->cell[i]->type == LVAL_ERR) {
-      return lval_take(v, i);
+/* State of the compiler: static nodes and constants with the code making
+ * them, and the function being written */
+typedef struct {
+  laot_buf decls;
+  laot_buf init;
+  laot_buf code;
+  int statics;
+  int temps;
+  int depth;
+  lcompiler *c;
+} laot;
+
+/* Line of the function being written */
+void laot_line(laot *g, char *fmt, ...) {
+  laot_printf(&g->code, "%*s", 2 * g->depth, "");
+  va_list va;
+  va_start(va, fmt);
+  laot_vprintf(&g->code, fmt, va);
+  va_end(va);
+  laot_printf(&g->code, "\n");
+}
+
+/* Static node looking up symbol 'sym' called with 'n' arguments or -1 */
+int laot_global(laot *g, char *sym, int n) {
+  int k = g->statics++;
+  laot_printf(&g->decls, "static lnode *s%i;\n", k);
+  laot_printf(&g->init, "  s%i = lnode_new(lnode_global, %i, lval_sym(", k, n);
+  laot_string(&g->init, sym);
+  laot_printf(&g->init, "));\n");
+  return k;
+}
+
+/* Static copy of constant 'v' */
+int laot_const(laot *g, lval *v) {
+  int k = g->statics++;
+  laot_printf(&g->decls, "static lval *s%i;\n", k);
+  laot_printf(&g->init, "  s%i = ", k);
+  laot_value(&g->init, v);
+  laot_printf(&g->init, ";\n");
+  return k;
+}
+
+int laot_compile_expr(laot *g, lval *x, int tail);
+int laot_compile_sexpr(laot *g, lval *x, int tail);
+
+/* Write statements running the special form 'x' of builtin 'op' inline
+ * into a new temporary, returning its number */
+int laot_compile_inline(laot *g, lval *x, int op, int tail) {
+
+  int t;
+
+  /* 'if' */
+  if (op == LOP_IF) {
+    int cond = laot_compile_expr(g, x->cell[1], 0);
+    t = g->temps++;
+    laot_line(g, "lval *t%i = t%i;", t, cond);
+    laot_line(g, "int b%i = laot_cond(&t%i);", t, t);
+    for (int i = 2; i < 4; i++) {
+      laot_line(g, i == 2 ? "if (b%i > 0) {" : "} else if (b%i == 0) {", t);
+      g->depth++;
+      int r = laot_compile_sexpr(g, x->cell[i], tail);
+      laot_line(g, "t%i = t%i;", t, r);
+      g->depth--;
     }
+    laot_line(g, "}");
+    return t;
   }
 
-  /* Empty Expression */
-  if (v->count == 0) {
-    return v;
+  /* '&&' and '||' */
+  t = g->temps++;
+  laot_line(g, "lval *t%i;", t);
+  laot_line(g, "do {");
+  g->depth++;
+  for (int i = 1; i < x->count; i++) {
+    int v = laot_compile_expr(g, x->cell[i], 0);
+    laot_line(g, "t%i = t%i;", t, v);
+    laot_line(g, "if (laot_bool(&t%i, %i)) {", t, op == LOP_OR);
+    laot_line(g, "  break;");
+    laot_line(g, "}");
   }
+  laot_line(g, "t%i = lval_num(%i);", t, op != LOP_OR);
+  g->depth--;
+  laot_line(g, "} while (0);");
+  return t;
+}
 
-  /* Single Expression */
-  if (v->count == 1) {
-    return lval_take(v, 0);
+/* Write statements evaluating 'x' into a new temporary, returning its
+ * number, see lnode_compile_sexpr */
+int laot_compile_sexpr(laot *g, lval *x, int tail) {
+  lcompiler *c = g->c;
+  int t;
+
+  if (x->count == 0) {
+    t = g->temps++;
+    laot_line(g, "lval *t%i = lval_sexpr();", t);
+    return t;
+  }
+  if (x->count == 1) {
+    return laot_compile_expr(g, x->cell[0], tail);
   }
 
-  /* Ensure first element is a function after evaluation */
-  lval *f = lval_pop(v, 0);
-  if (f->type != LVAL_FUN) {
-    lval *err = lval_err("S-Expression starts with incorrect type. "
-                         "Got %s, Expected %s.",
-                         ltype_name(f->type), ltype_name(LVAL_FUN));
-    lval_del(f);
-    lval_del(v);
+  /* 'if' with literal branches, '&&' and '||', guarded like in
+   * lcomp_sexpr. Loops call their builtins. */
+  int op = lcomp_form(c, x);
+  if (op == LOP_IF || op == LOP_AND || op == LOP_OR) {
+    t = g->temps++;
+    laot_line(g, "lval *t%i;", t);
+    laot_line(g, "if (lform_intact) {");
+    g->depth++;
+    int r = laot_compile_inline(g, x, op, tail);
+    laot_line(g, "t%i = t%i;", t, r);
+    g->depth--;
+    laot_line(g, "} else {");
+    laot_line(g, "  t%i = lform_eval(e, s%i);", t, laot_const(g, x));
+    laot_line(g, "}");
+    return t;
+  }
+
+  /* Operators applied to simple operands */
+  if (x->count == 3 && x->cell[0]->type == LVAL_SYM &&
+      lcomp_slot(c, x->cell[0]->sym) == -1 && lnode_is_operand(x->cell[1]) &&
+      lnode_is_operand(x->cell[2])) {
+    int f = laot_global(g, x->cell[0]->sym, 2);
+    int a = laot_compile_expr(g, x->cell[1], 0);
+    int b = laot_compile_expr(g, x->cell[2], 0);
+    t = g->temps++;
+    laot_line(g, "lval *t%i = lnode_binop(s%i, e, t%i, t%i, %i);", t, f, a, b,
+              tail);
+    return t;
+  }
+
+  /* Otherwise evaluate every element and call the first */
+  int items = g->temps++;
+  laot_line(g, "lval *i%i[%i];", items, x->count);
+  for (int i = 0; i < x->count; i++) {
+    int v;
+    if (i == 0 && x->cell[0]->type == LVAL_SYM &&
+        lcomp_slot(c, x->cell[0]->sym) == -1) {
+      v = g->temps++;
+      laot_line(g, "lval *t%i = lnode_global(s%i, e);", v,
+                laot_global(g, x->cell[0]->sym, x->count - 1));
+    } else {
+      v = laot_compile_expr(g, x->cell[i], 0);
+    }
+    laot_line(g, "i%i[%i] = t%i;", items, i, v);
+  }
+  t = g->temps++;
+  laot_line(g, "lval *t%i = lnode_apply(e, i%i, %i, %i);", t, items,
+            x->count - 1, tail);
+  return t;
+}
+
+int laot_compile_expr(laot *g, lval *x, int tail) {
+  int t;
+  switch (x->type) {
+  case LVAL_SYM: {
+    int slot = lcomp_slot(g->c, x->sym);
+    t = g->temps++;
+    if (slot >= 0) {
+      laot_line(g, "lval *t%i = laot_local(e, %i);", t, slot);
+    } else {
+      laot_line(g, "lval *t%i = lnode_global(s%i, e);", t,
+                laot_global(g, x->sym, -1));
+    }
+    return t;
+  }
+  case LVAL_SEXPR:
+    return laot_compile_sexpr(g, x, tail);
+  case LVAL_NUM:
+    t = g->temps++;
+    laot_line(g, "lval *t%i = lval_num(%liL);", t, x->num);
+    return t;
+  default:
+    t = g->temps++;
+    laot_line(g, "lval *t%i = lval_copy(s%i);", t, laot_const(g, x));
+    return t;
+  }
+}
+
+/* Name, formals and body of a top-level lambda definition 'x', as either
+ * (fun {name formals...} {body}) or (def {name} (\ {formals} {body})) */
+int laot_lambda_form(lval *x, char **name, lval **formals, lval **body) {
+  if (x->type != LVAL_SEXPR || x->count != 3 || x->cell[0]->type != LVAL_SYM ||
+      x->cell[1]->type != LVAL_QEXPR || x->cell[1]->count < 1) {
+    return 0;
+  }
+  lval *head = x->cell[1];
+  for (int i = 0; i < head->count; i++) {
+    if (head->cell[i]->type != LVAL_SYM) {
+      return 0;
+    }
+  }
+  *name = head->cell[0]->sym;
+  if (strcmp(x->cell[0]->sym, "fun") == 0 &&
+      x->cell[2]->type == LVAL_QEXPR) {
+    *formals = lval_qexpr();
+    for (int i = 1; i < head->count; i++) {
+      lval_add(*formals, lval_copy(head->cell[i]));
+    }
+    *body = x->cell[2];
+    return 1;
+  }
+  lval *l = x->cell[2];
+  if (strcmp(x->cell[0]->sym, "def") == 0 && head->count == 1 &&
+      l->type == LVAL_SEXPR && l->count == 3 && l->cell[0]->type == LVAL_SYM &&
+      strcmp(l->cell[0]->sym, "\\") == 0 && l->cell[1]->type == LVAL_QEXPR &&
+      l->cell[2]->type == LVAL_QEXPR) {
+    for (int i = 0; i < l->cell[1]->count; i++) {
+      if (l->cell[1]->cell[i]->type != LVAL_SYM) {
+        return 0;
+      }
+    }
+    *formals = lval_copy(l->cell[1]);
+    *body = l->cell[2];
+    return 1;
+  }
+  return 0;
+}
+
+/* Runtime functions generated code calls */
+char *laot_header =
+    "typedef struct lval lval;\n"
+    "typedef struct lenv lenv;\n"
+    "typedef struct lnode lnode;\n"
+    "lval *lval_num(long x);\n"
+    "lval *lval_sym(char *s);\n"
+    "lval *lval_str(char *s);\n"
+    "lval *lval_sexpr(void);\n"
+    "lval *lval_copy(lval *v);\n"
+    "lval *lform_eval(lenv *e, lval *x);\n"
+    "extern int lform_intact;\n"
+    "lnode *lnode_new(lval *(*run)(lnode *, lenv *), int arg, lval *val);\n"
+    "lval *lnode_global(lnode *n, lenv *e);\n"
+    "lval *lnode_apply(lenv *e, lval **items, int n, int tail);\n"
+    "lval *lnode_binop(lnode *g, lenv *e, lval *x, lval *y, int tail);\n"
+    "lval *laot_expr(int quoted, int count, ...);\n"
+    "lval *laot_local(lenv *e, int slot);\n"
+    "int laot_cond(lval **v);\n"
+    "int laot_bool(lval **v, int stop);\n"
+    "void laot_eval(lenv *e, lval *x);\n"
+    "void laot_install(lenv *e, char *name, int count,\n"
+    "                  lval *(*run)(lnode *, lenv *));\n";
+
+/* Write C source for the program in file 'path' to 'out' */
+lval *laot_compile(char *path, FILE *out) {
+  lval *expr = lread_file(path);
+  if (expr->type == LVAL_ERR) {
+    lval *err = lval_err("Could not load Library %s", expr->err);
+    lval_del(expr);
     return err;
   }
 
-  /* Call function to get result */
-  lval *result = lval_call(e, f, v);
-  lval_del(f);
-  return result;
+  laot g = {{NULL, 0, 0}, {NULL, 0, 0}, {NULL, 0, 0}, 0, 0, 0, NULL};
+  laot_buf run = {NULL, 0, 0};
+  /* Every buffer holds a string, even when nothing is written to it */
+  laot_printf(&g.decls, "");
+  laot_printf(&g.code, "");
+  laot_printf(&g.init, "");
+  laot_printf(&run, "");
+  for (int i = 0; i < expr->count; i++) {
+    lval *x = expr->cell[i];
+    laot_printf(&run, "  laot_eval(e, ");
+    laot_value(&run, x);
+    laot_printf(&run, ");\n");
+
+    char *name;
+    lval *formals;
+    lval *body;
+    if (!laot_lambda_form(x, &name, &formals, &body)) {
+      continue;
+    }
+    lcompiler c;
+    c.code = NULL;
+    c.formals = formals;
+    c.no_slots = lcomp_has_duplicates(formals);
+    c.depth = 0;
+    c.fold = 1;
+    g.c = &c;
+    g.temps = 0;
+    g.depth = 1;
+    laot_printf(&g.code, "\n/* %s */\nstatic lval *f%i(lnode *n, lenv *e) {\n",
+                name, i);
+    int t = laot_compile_sexpr(&g, body, 1);
+    laot_printf(&g.code, "  return t%i;\n}\n", t);
+    laot_printf(&run, "  laot_install(e, ");
+    laot_string(&run, name);
+    laot_printf(&run, ", %i, f%i);\n", formals->count, i);
+    lval_del(formals);
+  }
+
+  fprintf(out, "/* Generated by 'mlisp --compile-c %s' */\n\n%s\n%s%s\n", path,
+          laot_header, g.decls.s, g.code.s);
+  fprintf(out, "void mlisp_aot_main(lenv *e) {\n%s%s}\n", g.init.s, run.s);
+  free(g.decls.s);
+  free(g.init.s);
+  free(g.code.s);
+  free(run.s);
+  lval_del(expr);
+  return lval_sexpr();
 }
 
-lval *lval_eval(lenv *e, lval *v) {
-  if (v->type == LVAL_SYM) {
-    lval *x = lenv_get(e, v);
-    lval_del(v);
+/* C expression rebuilding value 'v' of an environment, with functions
+ * made in 'e'. Returns 0 for values an image cannot hold. */
+int laot_image_value(laot_buf *b, lval *v) {
+  switch (v->type) {
+  case LVAL_NUM:
+  case LVAL_SYM:
+  case LVAL_STR:
+    laot_value(b, v);
+    return 1;
+  case LVAL_SEXPR:
+  case LVAL_QEXPR:
+    laot_printf(b, "laot_expr(%i, %i", v->type == LVAL_QEXPR, v->count);
+    for (int i = 0; i < v->count; i++) {
+      laot_printf(b, ", ");
+      if (!laot_image_value(b, v->cell[i])) {
+        return 0;
+      }
+    }
+    laot_printf(b, ")");
+    return 1;
+  case LVAL_FUN:
+    if (v->memo || v->partial) {
+      return 0;
+    }
+    if (v->builtin) {
+      laot_printf(b, "laot_builtin(");
+      laot_string(b, lbuiltins[v->op].name);
+      laot_printf(b, ")");
+      return 1;
+    }
+    if (v->env->count) {
+      return 0;
+    }
+    laot_printf(b, "lenv_lambda(e, ");
+    laot_value(b, v->formals);
+    laot_printf(b, ", ");
+    laot_value(b, v->body);
+    laot_printf(b, ")");
+    return 1;
+  }
+  return 0;
+}
+
+/* Write C source of function 'stdlib_image', defining in an environment
+ * what evaluating file 'path' defines next to the builtins, to 'out' */
+lval *laot_image(char *path, FILE *out) {
+  lenv *e = lenv_new();
+  lenv_add_builtins(e);
+  lval *x = lenv_load(e, path);
+  if (x->type == LVAL_ERR) {
+    lenv_del(e);
     return x;
   }
-  /* Evaluate Sexpressions */
-  if (v->type == LVAL_SEXPR) {
-    return lval_eval_sexpr(e, v);
+  lval_del(x);
+
+  laot_buf defs = {NULL, 0, 0};
+  laot_printf(&defs, "");
+  for (int i = 0; i < e->count; i++) {
+    /* Imports are written as the values they refer to */
+    lval **slot = lenv_follow(&e->vals[i], e->syms[i]);
+    if (!slot) {
+      continue;
+    }
+    lval *v = *slot;
+    if (v->type == LVAL_FUN && v->builtin && !v->memo && !v->partial &&
+        strcmp(lbuiltins[v->op].name, e->syms[i]) == 0) {
+      continue;
+    }
+    laot_printf(&defs, "  laot_def(e, ");
+    laot_string(&defs, e->syms[i]);
+    laot_printf(&defs, ", ");
+    if (!laot_image_value(&defs, v)) {
+      x = lval_err("Cannot write '%s' of type %s to an image.", e->syms[i],
+                   ltype_name(v->type));
+      free(defs.s);
+      lenv_del(e);
+      return x;
+    }
+    laot_printf(&defs, ");\n");
   }
-  /* All other lval types remain the same */
-  return v;
+
+  fprintf(out, "/* Generated by 'mlisp --image-c %s' */\n\n%s", path,
+          laot_header);
+  fprintf(out, "lval *lenv_lambda(lenv *e, lval *formals, lval *body);\n"
+               "lval *laot_builtin(char *name);\n"
+               "void laot_def(lenv *e, char *name, lval *v);\n\n");
+  fprintf(out, "int stdlib_image(lenv *e) {\n%s  return 0;\n}\n", defs.s);
+  free(defs.s);
+  lenv_del(e);
+  return lval_sexpr();
+}
+
+/* Runtime of compiled programs */
+
+/* Expression of 'count' values given after it */
+lval *laot_expr(int quoted, int count, ...) {
+  lval *x = quoted ? lval_qexpr() : lval_sexpr();
+  va_list va;
+  va_start(va, count);
+  for (int i = 0; i < count; i++) {
+    lval_add(x, va_arg(va, lval *));
+  }
+  va_end(va);
+  return x;
+}
+
+lval *laot_local(lenv *e, int slot) { return lval_copy(e->vals[slot]); }
+
+/* Truth of the condition of an 'if' in '*v', which is deleted, or -1 with
+ * '*v' the error to return, see lnode_if */
+int laot_cond(lval **v) {
+  lval *cond = *v;
+  if (cond->type == LVAL_NUM) {
+    int t = cond->num != 0;
+    lval_del(cond);
+    return t;
+  }
+  if (cond->type != LVAL_ERR) {
+    *v = lval_err("Function '%s' passed incorrect type. Got %s, "
+                  "Expected %s.",
+                  "if", ltype_name(cond->type), ltype_name(LVAL_NUM));
+    lval_del(cond);
+  }
+  return -1;
+}
+
+/* Whether operand '*v' of '&&', or '||' when 'stop', decides the result,
+ * which is left in '*v'. Otherwise it is deleted, see lnode_bool. */
+int laot_bool(lval **v, int stop) {
+  lval *x = *v;
+  if (x->type == LVAL_ERR) {
+    return 1;
+  }
+  if (x->type != LVAL_NUM) {
+    *v = lval_err("Function '%s' passed incorrect type. Got %s, "
+                  "Expected %s.",
+                  stop ? "||" : "&&", ltype_name(x->type),
+                  ltype_name(LVAL_NUM));
+    lval_del(x);
+    return 1;
+  }
+  int decides = !x->num == !stop;
+  lval_del(x);
+  if (decides) {
+    *v = lval_num(stop);
+  }
+  return decides;
+}
+
+/* Evaluate a top-level expression, printing errors like lenv_load */
+void laot_eval(lenv *e, lval *x) {
+  x = lval_eval(e, x);
+  if (x->type == LVAL_ERR) {
+    lval_println(x);
+  }
+  lval_del(x);
 }
 
-void lenv_add_builtin(lenv *e, char *name, lbuiltin func) {
+/* Builtin 'name' */
+lval *laot_builtin(char *name) {
+  for (int op = 0; op < LOP_COUNT; op++) {
+    if (strcmp(lbuiltins[op].name, name) == 0) {
+      return lval_fun(op);
+    }
+  }
+  return lval_err("Unbound Symbol '%s'", name);
+}
+
+/* Define 'name' to 'v' as 'def' does */
+void laot_def(lenv *e, char *name, lval *v) {
   lval *k = lval_sym(name);
-  lval *v = lval_fun(func);
+  lfold_forget(name);
+  lenv_def(e, k, v);
+  lval_del(k);
+  lval_del(v);
+}
+
+/* Run lambda 'name' with 'count' formals defined in 'e' with 'run' */
+void laot_install(lenv *e, char *name, int count,
+                  lval *(*run)(lnode *, lenv *)) {
+  lval **slot = lenv_slot(e, name);
+  if (!slot) {
+    return;
+  }
+  lval *f = *slot;
+  if (f->type != LVAL_FUN || f->builtin || f->formals->count != count) {
+    return;
+  }
+  if (f->code) {
+    lcode_release(f->code);
+    f->code = NULL;
+  }
+  if (f->node) {
+    lnode_release(f->node);
+  }
+  f->node = lnode_new(run, 0, NULL);
+}
+
+/* Dispatch table indexed by builtin opcode */
+#define X(op, name, func) {name, func},
+lbuiltin_entry lbuiltins[LOP_COUNT] = {LBUILTINS(X)};
+#undef X
+
+void lenv_add_builtin(lenv *e, int op) {
+  lval *k = lval_sym(lbuiltins[op].name);
+  lval *v = lval_fun(op);
   lenv_put(e, k, v);
   lval_del(k);
   lval_del(v);
 }
 
 void lenv_add_builtins(lenv *e) {
-  /* List Functions */
-  lenv_add_builtin(e, "list", builtin_list);
-  lenv_add_builtin(e, "head", builtin_head);
-  lenv_add_builtin(e, "tail", builtin_tail);
-  lenv_add_builtin(e, "eval", builtin_eval);
-  lenv_add_builtin(e, "join", builtin_join);
-
-  /* Mathematical Functions */
-  lenv_add_builtin(e, "+", builtin_add);
-  lenv_add_builtin(e, "-", builtin_sub);
-  lenv_add_builtin(e, "*", builtin_mul);
-  lenv_add_builtin(e, "/", builtin_div);
-
-  /* Variable Functions */
-  lenv_add_builtin(e, "def", builtin_def);
-  lenv_add_builtin(e, "=", builtin_put);
-  lenv_add_builtin(e, "\\", builtin_lambda);
-  lenv_add_builtin(e, "fun", builtin_fun);
-
-  /* Comparison Functions */
-  lenv_add_builtin(e, "<", builtin_lt);
-  lenv_add_builtin(e, "<=", builtin_lte);
-  lenv_add_builtin(e, ">", builtin_gt);
-  lenv_add_builtin(e, ">=", builtin_gte);
-  lenv_add_builtin(e, "==", builtin_eq);
-  lenv_add_builtin(e, "!=", builtin_ne);
-  lenv_add_builtin(e, "&&", builtin_and);
-  lenv_add_builtin(e, "||", builtin_or);
-  lenv_add_builtin(e, "!", builtin_not);
-  lenv_add_builtin(e, "if", builtin_if);
-
-  /* String Functions */
-  lenv_add_builtin(e, "load", builtin_load);
-  lenv_add_builtin(e, "error", builtin_error);
-  lenv_add_builtin(e, "print", builtin_print);
+  for (int op = 0; op < LOP_COUNT; op++) {
+    lenv_add_builtin(e, op);
+  }
 }
 
 extern const int stdlib_mlisp_size;
 extern const char stdlib_mlisp[];
 
+/* Defines the stdlib in 'e' and returns 0, or returns 1 in builds without
+ * an image, see laot_image */
+int stdlib_image(lenv *e);
+
 int init_stdlib(lenv *e) {
   /* Attempt to Parse the user Input */
-  mpc_result_t r;
-  if (mpc_nparse("<stdlib>", stdlib_mlisp, stdlib_mlisp_size, Mlisp, &r)) {
-    lval *x = lval_eval(e, lval_read(r.output));
-    lval_del(x);
-    mpc_ast_delete(r.output);
-  } else {
+  lval *x = lread("<stdlib>", stdlib_mlisp, stdlib_mlisp_size);
+  if (x->type == LVAL_ERR) {
     /* Otherwise Print the Error */
-    mpc_err_print(r.error);
-    mpc_err_delete(r.error);
+    lval_println(x);
+    lval_del(x);
     return 1;
   }
+  lval_del(lval_eval(e, x));
   return 0;
 }
 
 #if __EMSCRIPTEN__
 EMSCRIPTEN_KEEPALIVE
 #endif
+/* Lazy stdlib: with --lazy-stdlib the stdlib text is only split into its
+ * top-level forms at startup. A form defining a name with 'def' or 'fun' is
+ * parsed and evaluated the first time a lookup of that name misses. */
+int lstub_lazy = 0;
+
+typedef struct {
+  char *sym;
+  const char *src;
+  int len;
+} lstub;
+
+lstub *lstubs = NULL;
+int lstubs_count = 0;
+
+/* Parse and evaluate the stdlib form of 'len' characters at 'src' */
+void lstub_eval(lenv *e, const char *src, int len) {
+  lval *x = lread("<stdlib>", src, len);
+  if (x->type == LVAL_ERR) {
+    lval_println(x);
+    lval_del(x);
+    return;
+  }
+  lval_del(lval_eval(e, x));
+}
+
+/* Make the stdlib definition of 'sym' in 'e', the root environment,
+ * returning whether there was one left to make */
+int lstub_force(lenv *e, char *sym) {
+  for (int i = 0; i < lstubs_count; i++) {
+    if (strcmp(lstubs[i].sym, sym) == 0) {
+      /* Remove it first, its form may look up 'sym' again */
+      lstub s = lstubs[i];
+      lstubs[i] = lstubs[--lstubs_count];
+      lstub_eval(e, s.src, s.len);
+      free(s.sym);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+const char *lstub_space(const char *s, const char *end) {
+  while (s < end && isspace((unsigned char)*s)) {
+    s++;
+  }
+  return s;
+}
+
+/* Whether the value at 's' is a constant or a lambda, which gives the
+ * same whenever it is evaluated */
+int lstub_literal(const char *s, const char *end) {
+  if (s == end) {
+    return 0;
+  }
+  if (*s == '(') {
+    s = lstub_space(s + 1, end);
+    return end - s > 1 && *s == '\\' && isspace((unsigned char)s[1]);
+  }
+  return *s == '{' || *s == '"' || isdigit((unsigned char)*s) ||
+         (*s == '-' && end - s > 1 && isdigit((unsigned char)s[1]));
+}
+
+/* Name a stdlib form defines with 'fun', or with 'def' of one symbol to a
+ * literal, or NULL. Other definitions depend on what is bound when they
+ * are made, so they are not deferred. */
+char *lstub_name(const char *s, const char *end) {
+  s = lstub_space(s + 1, end);
+  if (end - s < 4 || (strncmp(s, "def", 3) && strncmp(s, "fun", 3)) ||
+      !isspace((unsigned char)s[3])) {
+    return NULL;
+  }
+  int def = *s == 'd';
+  s = lstub_space(s + 3, end);
+  if (s == end || *s != '{') {
+    return NULL;
+  }
+  s = lstub_space(s + 1, end);
+  const char *name = s;
+  while (s < end && !isspace((unsigned char)*s) && *s != '}') {
+    s++;
+  }
+  if (s == name) {
+    return NULL;
+  }
+  if (def) {
+    const char *close = lstub_space(s, end);
+    if (close == end || *close != '}' ||
+        !lstub_literal(lstub_space(close + 1, end), end)) {
+      return NULL;
+    }
+  }
+  char *sym = malloc(s - name + 1);
+  memcpy(sym, name, s - name);
+  sym[s - name] = '\0';
+  return sym;
+}
+
+/* Register the definitions of the stdlib as stubs, evaluating any other
+ * top-level form right away */
+void lstub_init(lenv *e) {
+  const char *s = stdlib_mlisp;
+  const char *end = s + stdlib_mlisp_size;
+  while (s < end) {
+    if (*s == ';') {
+      while (s < end && *s != '\n') {
+        s++;
+      }
+      continue;
+    }
+    if (*s != '(') {
+      s++;
+      continue;
+    }
+
+    /* Find the end of the form, skipping strings and comments */
+    const char *start = s;
+    int depth = 0;
+    for (; s < end; s++) {
+      if (*s == '"') {
+        for (s++; s < end && *s != '"'; s++) {
+          s += *s == '\\';
+        }
+      } else if (*s == ';') {
+        while (s < end && *s != '\n') {
+          s++;
+        }
+      } else if (*s == '(') {
+        depth++;
+      } else if (*s == ')' && --depth == 0) {
+        s++;
+        break;
+      }
+    }
+
+    char *sym = lstub_name(start, s);
+    if (!sym) {
+      lstub_eval(e, start, s - start);
+      continue;
+    }
+    lstubs = realloc(lstubs, sizeof(lstub) * (lstubs_count + 1));
+    lstubs[lstubs_count].sym = sym;
+    lstubs[lstubs_count].src = start;
+    lstubs[lstubs_count].len = s - start;
+    lstubs_count++;
+  }
+}
+
 int mlisp_init() {
   Number = mpc_new("number");
   Symbol = mpc_new("symbol");
@@ -1327,12 +7978,19 @@ int mlisp_init() {
   ",
             Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Mlisp);
 
+  /* Measure C stack use from here */
+  char top;
+  lstack_top = &top;
+
   lenv *e = lenv_new();
   lenv_add_builtins(e);
 
-  int err;
-
-  if ((err = init_stdlib(e))) {
+  /* The stdlib is defined lazily when asked, otherwise from the image built
+   * in when there is one, otherwise its text is parsed and evaluated */
+  int err = 0;
+  if (lstub_lazy) {
+    lstub_init(e);
+  } else if (stdlib_image(e) && (err = init_stdlib(e))) {
     printf("Error: Could not initialize stdlib!\n");
     return err;
   }
@@ -1351,20 +8009,13 @@ char *mlisp_interpret(char *input) {
     free(out);
     out = NULL;
   }
-  /* Attempt to Parse the user Input */
-  mpc_result_t r;
-  if (mpc_parse("<stdin>", input, Mlisp, &r)) {
-    lval *x = lval_eval(globalEnv, lval_read(r.output));
-    out = lval_to_str(x);
-    lval_del(x);
-    mpc_ast_delete(r.output);
-  } else {
-    /* Otherwise Print the Error */
-    char *error = mpc_err_string(r.error);
-    out = malloc(sizeof(char) * (strlen(error) + 1));
-    sprintf(out, "%s", error);
-    mpc_err_delete(r.error);
+  /* Attempt to Parse the user Input, otherwise return the Error */
+  lval *x = lread("<stdin>", input, strlen(input));
+  if (x->type != LVAL_ERR) {
+    x = lval_eval(globalEnv, x);
   }
+  out = lval_to_str(x);
+  lval_del(x);
   return out;
 }
 #endif
@@ -1375,6 +8026,26 @@ EMSCRIPTEN_KEEPALIVE
 void mlisp_cleanup() {
   lenv_del(globalEnv);
 
+  for (int i = 0; i < modules_count; i++) {
+    free(modules[i].path);
+    lenv_del(modules[i].env);
+    if (modules[i].exports) {
+      lval_del(modules[i].exports);
+    }
+  }
+  free(modules);
+
+  for (int i = 0; i < lstubs_count; i++) {
+    free(lstubs[i].sym);
+  }
+  free(lstubs);
+
+  while (lval_free_list) {
+    lval *v = lval_free_list;
+    lval_free_list = v->formals;
+    free(v);
+  }
+
   mpc_cleanup(8, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Mlisp);
 
   #if __EMSCRIPTEN__
@@ -1386,40 +8057,141 @@ void mlisp_cleanup() {
 }
 
 #if !__EMSCRIPTEN__
+/* Set while the prompt is evaluating an expression */
+volatile sig_atomic_t repl_evaluating = 0;
+
+#if MLISP_AOT
+void mlisp_aot_main(lenv *e);
+#endif
+
+/* Ctrl+c interrupts a running evaluation, and exits at the prompt */
+void repl_sigint(int sig) {
+  if (!repl_evaluating) {
+    signal(SIGINT, SIG_DFL);
+    raise(SIGINT);
+    return;
+  }
+  linterrupted = 1;
+  signal(SIGINT, repl_sigint);
+}
+
 void repl() {
+  signal(SIGINT, repl_sigint);
+
   while (1) {
     /* Now in either case readline will be correctly defined */
     char *input = readline("mlisp> ");
     add_history(input);
 
     /* Attempt to Parse the user Input */
-    mpc_result_t r;
-    if (mpc_parse("<stdin>", input, Mlisp, &r)) {
-      lval *x = lval_eval(globalEnv, lval_read(r.output));
-      lval_println(x);
-      lval_del(x);
-      mpc_ast_delete(r.output);
-    } else {
-      /* Otherwise Print the Error */
-      mpc_err_print(r.error);
-      mpc_err_delete(r.error);
+    lval *x = lread("<stdin>", input, strlen(input));
+    if (x->type != LVAL_ERR) {
+      linterrupted = 0;
+      repl_evaluating = 1;
+      x = lval_eval(globalEnv, x);
+      repl_evaluating = 0;
     }
+    /* Print the result, or the Error */
+    lval_println(x);
+    lval_del(x);
 
     free(input);
   }
 }
 
 int main(int argc, char **argv) {
+  /* Options come before the list of files */
+  int first = 1;
+  char *compile = NULL;
+  int image = 0;
+  char *save = NULL;
+  char *load = NULL;
+  for (; first < argc && strncmp(argv[first], "--", 2) == 0; first++) {
+    if (strcmp(argv[first], "--no-vm") == 0) {
+      lengine = LENGINE_WALK;
+    } else if (strcmp(argv[first], "--engine") == 0 && first + 1 < argc) {
+      char *name = argv[++first];
+      if (strcmp(name, "walk") == 0) {
+        lengine = LENGINE_WALK;
+      } else if (strcmp(name, "vm") == 0) {
+        lengine = LENGINE_VM;
+      } else if (strcmp(name, "closure") == 0) {
+        lengine = LENGINE_CLOSURE;
+      } else {
+        fprintf(stderr, "Unknown engine '%s'\n", name);
+        return 1;
+      }
+    } else if (strcmp(argv[first], "--dump-folds") == 0) {
+      lfold_dump = 1;
+    } else if (strcmp(argv[first], "--no-fuse") == 0) {
+      lpipe_fuse = 0;
+    } else if (strcmp(argv[first], "--no-specialize") == 0) {
+      lkern_enabled = 0;
+    } else if (strcmp(argv[first], "--jit-threshold") == 0 &&
+               first + 1 < argc) {
+      ljit_threshold = atoi(argv[++first]);
+    } else if (strcmp(argv[first], "--stats") == 0) {
+      lval_stats = 1;
+    } else if (strcmp(argv[first], "--max-depth") == 0 && first + 1 < argc) {
+      lvm_max_depth = atoi(argv[++first]);
+    } else if (strcmp(argv[first], "--compile-c") == 0 && first + 1 < argc) {
+      compile = argv[++first];
+    } else if (strcmp(argv[first], "--image-c") == 0 && first + 1 < argc) {
+      compile = argv[++first];
+      image = 1;
+    } else if (strcmp(argv[first], "--mpc-reader") == 0) {
+      lread_mpc = 1;
+    } else if (strcmp(argv[first], "--lazy-stdlib") == 0) {
+      lstub_lazy = 1;
+    } else if (strcmp(argv[first], "--save-image") == 0 && first + 1 < argc) {
+      save = argv[++first];
+    } else if (strcmp(argv[first], "--load-image") == 0 && first + 1 < argc) {
+      load = argv[++first];
+    } else {
+      fprintf(stderr, "Unknown option '%s'\n", argv[first]);
+      return 1;
+    }
+  }
+
   int err;
   if ((err = mlisp_init())) {
     return err;
   }
 
+  if (load) {
+    lval *x = limg_load(globalEnv, load);
+    err = x->type == LVAL_ERR;
+    if (err) {
+      lval_println(x);
+    }
+    lval_del(x);
+    if (err) {
+      mlisp_cleanup();
+      return err;
+    }
+  }
+
+  if (compile) {
+    lval *x = image ? laot_image(compile, stdout)
+                    : laot_compile(compile, stdout);
+    err = x->type == LVAL_ERR;
+    if (err) {
+      lval_println(x);
+    }
+    lval_del(x);
+    mlisp_cleanup();
+    return err;
+  }
+
+#if MLISP_AOT
+  /* Built with a program compiled by --compile-c, which runs instead */
+  mlisp_aot_main(globalEnv);
+#else
   /* Supplied with list of files */
-  if (argc >= 2) {
+  if (argc > first) {
 
-    /* loop over each supplied filename (starting from 1) */
-    for (int i = 1; i < argc; i++) {
+    /* loop over each supplied filename */
+    for (int i = first; i < argc; i++) {
 
       /* Argument list with a single argument, the filename */
       lval *args = lval_add(lval_sexpr(), lval_str(argv[i]));
@@ -1433,14 +8205,30 @@ int main(int argc, char **argv) {
       }
       lval_del(x);
     }
-  } else {
+  } else if (!save) {
     puts("mlisp Version 0.0.0.0.1");
     puts("Press Ctrl+c to Exit\n");
     repl();
   }
+#endif
+
+  /* Write what the files defined, to start from it with --load-image */
+  if (save) {
+    lval *x = limg_save(globalEnv, save);
+    err = x->type == LVAL_ERR;
+    if (err) {
+      lval_println(x);
+    }
+    lval_del(x);
+  }
+
+  if (lval_stats) {
+    fprintf(stderr, "lvals allocated: %li, elements added: %li\n",
+            lval_allocs, lval_adds);
+  }
 
   mlisp_cleanup();
 
-  return 0;
+  return err;
 }
 #endif
@@ -0,0 +1,63 @@
+/* Generated by 'mlisp --compile-c test/aot_strings.mlisp' */
+
+typedef struct lval lval;
+typedef struct lenv lenv;
+typedef struct lnode lnode;
+lval *lval_num(long x);
+lval *lval_sym(char *s);
+lval *lval_str(char *s);
+lval *lval_sexpr(void);
+lval *lval_copy(lval *v);
+lval *lform_eval(lenv *e, lval *x);
+extern int lform_intact;
+lnode *lnode_new(lval *(*run)(lnode *, lenv *), int arg, lval *val);
+lval *lnode_global(lnode *n, lenv *e);
+lval *lnode_apply(lenv *e, lval **items, int n, int tail);
+lval *lnode_binop(lnode *g, lenv *e, lval *x, lval *y, int tail);
+lval *laot_expr(int quoted, int count, ...);
+lval *laot_local(lenv *e, int slot);
+int laot_cond(lval **v);
+int laot_bool(lval **v, int stop);
+void laot_eval(lenv *e, lval *x);
+void laot_install(lenv *e, char *name, int count,
+                  lval *(*run)(lnode *, lenv *));
+
+static lnode *s0;
+static lval *s1;
+static lval *s2;
+static lval *s3;
+static lval *s4;
+static lval *s5;
+
+/* show */
+static lval *f0(lnode *n, lenv *e) {
+  lval *i0[7];
+  lval *t1 = lnode_global(s0, e);
+  i0[0] = t1;
+  lval *t2 = laot_local(e, 0);
+  i0[1] = t2;
+  lval *t3 = lval_copy(s1);
+  i0[2] = t3;
+  lval *t4 = lval_copy(s2);
+  i0[3] = t4;
+  lval *t5 = lval_copy(s3);
+  i0[4] = t5;
+  lval *t6 = lval_copy(s4);
+  i0[5] = t6;
+  lval *t7 = lval_copy(s5);
+  i0[6] = t7;
+  lval *t8 = lnode_apply(e, i0, 6, 1);
+  return t8;
+}
+
+void mlisp_aot_main(lenv *e) {
+  s0 = lnode_new(lnode_global, 6, lval_sym("print"));
+  s1 = lval_str("\077\077=");
+  s2 = lval_str("\077\077/");
+  s3 = lval_str("a\042b");
+  s4 = lval_str("*/");
+  s5 = lval_str("\077\077)\077\077(\077\077!");
+  laot_eval(e, laot_expr(0, 3, lval_sym("fun"), laot_expr(1, 2, lval_sym("show"), lval_sym("x")), laot_expr(1, 7, lval_sym("print"), lval_sym("x"), lval_str("\077\077="), lval_str("\077\077/"), lval_str("a\042b"), lval_str("*/"), lval_str("\077\077)\077\077(\077\077!"))));
+  laot_install(e, "show", 1, f0);
+  laot_eval(e, laot_expr(0, 2, lval_sym("show"), lval_str("x \077\077= */")));
+}
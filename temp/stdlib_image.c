@@ -0,0 +1,50 @@
+/* Generated by 'mlisp --image-c ./stdlib.mlisp' */
+
+typedef struct lval lval;
+typedef struct lenv lenv;
+typedef struct lnode lnode;
+lval *lval_num(long x);
+lval *lval_sym(char *s);
+lval *lval_str(char *s);
+lval *lval_sexpr(void);
+lval *lval_copy(lval *v);
+lval *lform_eval(lenv *e, lval *x);
+extern int lform_intact;
+lnode *lnode_new(lval *(*run)(lnode *, lenv *), int arg, lval *val);
+lval *lnode_global(lnode *n, lenv *e);
+lval *lnode_apply(lenv *e, lval **items, int n, int tail);
+lval *lnode_binop(lnode *g, lenv *e, lval *x, lval *y, int tail);
+lval *laot_expr(int quoted, int count, ...);
+lval *laot_local(lenv *e, int slot);
+int laot_cond(lval **v);
+int laot_bool(lval **v, int stop);
+void laot_eval(lenv *e, lval *x);
+void laot_install(lenv *e, char *name, int count,
+                  lval *(*run)(lnode *, lenv *));
+lval *lenv_lambda(lenv *e, lval *formals, lval *body);
+lval *laot_builtin(char *name);
+void laot_def(lenv *e, char *name, lval *v);
+
+int stdlib_image(lenv *e) {
+  laot_def(e, "stdlib", lval_str("0.0.0.0.1"));
+  laot_def(e, "nil", laot_expr(1, 0));
+  laot_def(e, "true", lval_num(1L));
+  laot_def(e, "false", lval_num(0L));
+  laot_def(e, "unpack", lenv_lambda(e, laot_expr(1, 2, lval_sym("f"), lval_sym("l")), laot_expr(1, 2, lval_sym("eval"), laot_expr(0, 3, lval_sym("join"), laot_expr(0, 2, lval_sym("list"), lval_sym("f")), lval_sym("l")))));
+  laot_def(e, "pack", lenv_lambda(e, laot_expr(1, 3, lval_sym("f"), lval_sym("&"), lval_sym("xs")), laot_expr(1, 2, lval_sym("f"), lval_sym("xs"))));
+  laot_def(e, "curry", lenv_lambda(e, laot_expr(1, 2, lval_sym("f"), lval_sym("l")), laot_expr(1, 2, lval_sym("eval"), laot_expr(0, 3, lval_sym("join"), laot_expr(0, 2, lval_sym("list"), lval_sym("f")), lval_sym("l")))));
+  laot_def(e, "uncurry", lenv_lambda(e, laot_expr(1, 3, lval_sym("f"), lval_sym("&"), lval_sym("xs")), laot_expr(1, 2, lval_sym("f"), lval_sym("xs"))));
+  laot_def(e, "fst", lenv_lambda(e, laot_expr(1, 1, lval_sym("l")), laot_expr(1, 2, lval_sym("eval"), laot_expr(0, 2, lval_sym("head"), lval_sym("l")))));
+  laot_def(e, "snd", lenv_lambda(e, laot_expr(1, 1, lval_sym("l")), laot_expr(1, 2, lval_sym("eval"), laot_expr(0, 2, lval_sym("head"), laot_expr(0, 2, lval_sym("tail"), lval_sym("l"))))));
+  laot_def(e, "trd", lenv_lambda(e, laot_expr(1, 1, lval_sym("l")), laot_expr(1, 2, lval_sym("eval"), laot_expr(0, 2, lval_sym("head"), laot_expr(0, 2, lval_sym("tail"), laot_expr(0, 2, lval_sym("tail"), lval_sym("l")))))));
+  laot_def(e, "split", lenv_lambda(e, laot_expr(1, 2, lval_sym("n"), lval_sym("l")), laot_expr(1, 3, lval_sym("list"), laot_expr(0, 3, lval_sym("take"), lval_sym("n"), lval_sym("l")), laot_expr(0, 3, lval_sym("drop"), lval_sym("n"), lval_sym("l")))));
+  laot_def(e, "do", lenv_lambda(e, laot_expr(1, 2, lval_sym("&"), lval_sym("l")), laot_expr(1, 4, lval_sym("if"), laot_expr(0, 3, lval_sym("=="), lval_sym("l"), lval_sym("nil")), laot_expr(1, 1, lval_sym("nil")), laot_expr(1, 2, lval_sym("last"), lval_sym("l")))));
+  laot_def(e, "select", lenv_lambda(e, laot_expr(1, 2, lval_sym("&"), lval_sym("cs")), laot_expr(1, 4, lval_sym("if"), laot_expr(0, 3, lval_sym("=="), lval_sym("cs"), lval_sym("nil")), laot_expr(1, 2, lval_sym("error"), lval_str("No Selection Found")), laot_expr(1, 4, lval_sym("if"), laot_expr(0, 2, lval_sym("fst"), laot_expr(0, 2, lval_sym("fst"), lval_sym("cs"))), laot_expr(1, 2, lval_sym("snd"), laot_expr(0, 2, lval_sym("fst"), lval_sym("cs"))), laot_expr(1, 3, lval_sym("unpack"), lval_sym("select"), laot_expr(0, 2, lval_sym("tail"), lval_sym("cs")))))));
+  laot_def(e, "case", lenv_lambda(e, laot_expr(1, 3, lval_sym("x"), lval_sym("&"), lval_sym("cs")), laot_expr(1, 4, lval_sym("if"), laot_expr(0, 3, lval_sym("=="), lval_sym("cs"), lval_sym("nil")), laot_expr(1, 2, lval_sym("error"), lval_str("No Case Found")), laot_expr(1, 4, lval_sym("if"), laot_expr(0, 3, lval_sym("=="), lval_sym("x"), laot_expr(0, 2, lval_sym("fst"), laot_expr(0, 2, lval_sym("fst"), lval_sym("cs")))), laot_expr(1, 2, lval_sym("snd"), laot_expr(0, 2, lval_sym("fst"), lval_sym("cs"))), laot_expr(1, 3, lval_sym("unpack"), lval_sym("case"), laot_expr(0, 3, lval_sym("join"), laot_expr(0, 2, lval_sym("list"), lval_sym("x")), laot_expr(0, 2, lval_sym("tail"), lval_sym("cs"))))))));
+  laot_def(e, "otherwise", lval_num(1L));
+  laot_def(e, "let", lenv_lambda(e, laot_expr(1, 1, lval_sym("b")), laot_expr(1, 1, laot_expr(0, 2, laot_expr(0, 3, lval_sym("\134"), laot_expr(1, 1, lval_sym("_")), lval_sym("b")), laot_expr(0, 0)))));
+  laot_def(e, "flip", lenv_lambda(e, laot_expr(1, 3, lval_sym("f"), lval_sym("a"), lval_sym("b")), laot_expr(1, 3, lval_sym("f"), lval_sym("b"), lval_sym("a"))));
+  laot_def(e, "ghost", lenv_lambda(e, laot_expr(1, 2, lval_sym("&"), lval_sym("xs")), laot_expr(1, 2, lval_sym("eval"), lval_sym("xs"))));
+  laot_def(e, "comp", lenv_lambda(e, laot_expr(1, 3, lval_sym("f"), lval_sym("g"), lval_sym("x")), laot_expr(1, 2, lval_sym("f"), laot_expr(0, 2, lval_sym("g"), lval_sym("x")))));
+  return 0;
+}
@@ -0,0 +1,82 @@
+/* Embedded file: ./stdlib.mlisp */
+const int stdlib_mlisp_size = 1248;
+const unsigned char stdlib_mlisp[] = {
+0x3b,0x20,0x56,0x65,0x72,0x73,0x69,0x6f,0x6e,0x0a,0x28,0x64,0x65,0x66,0x20,0x7b,
+0x73,0x74,0x64,0x6c,0x69,0x62,0x7d,0x20,0x22,0x30,0x2e,0x30,0x2e,0x30,0x2e,0x30,
+0x2e,0x31,0x22,0x29,0x0a,0x0a,0x3b,0x20,0x41,0x74,0x6f,0x6d,0x73,0x0a,0x28,0x64,
+0x65,0x66,0x20,0x7b,0x6e,0x69,0x6c,0x7d,0x20,0x7b,0x7d,0x29,0x0a,0x28,0x64,0x65,
+0x66,0x20,0x7b,0x74,0x72,0x75,0x65,0x7d,0x20,0x31,0x29,0x0a,0x28,0x64,0x65,0x66,
+0x20,0x7b,0x66,0x61,0x6c,0x73,0x65,0x7d,0x20,0x30,0x29,0x0a,0x0a,0x3b,0x20,0x55,
+0x6e,0x70,0x61,0x63,0x6b,0x20,0x4c,0x69,0x73,0x74,0x20,0x66,0x6f,0x72,0x20,0x46,
+0x75,0x6e,0x63,0x74,0x69,0x6f,0x6e,0x0a,0x28,0x66,0x75,0x6e,0x20,0x7b,0x75,0x6e,
+0x70,0x61,0x63,0x6b,0x20,0x66,0x20,0x6c,0x7d,0x20,0x7b,0x0a,0x20,0x20,0x65,0x76,
+0x61,0x6c,0x20,0x28,0x6a,0x6f,0x69,0x6e,0x20,0x28,0x6c,0x69,0x73,0x74,0x20,0x66,
+0x29,0x20,0x6c,0x29,0x0a,0x7d,0x29,0x0a,0x0a,0x3b,0x20,0x50,0x61,0x63,0x6b,0x20,
+0x4c,0x69,0x73,0x74,0x20,0x66,0x6f,0x72,0x20,0x46,0x75,0x6e,0x63,0x74,0x69,0x6f,
+0x6e,0x0a,0x28,0x66,0x75,0x6e,0x20,0x7b,0x70,0x61,0x63,0x6b,0x20,0x66,0x20,0x26,
+0x20,0x78,0x73,0x7d,0x20,0x7b,0x66,0x20,0x78,0x73,0x7d,0x29,0x0a,0x0a,0x3b,0x20,
+0x43,0x75,0x72,0x72,0x69,0x65,0x64,0x20,0x61,0x6e,0x64,0x20,0x55,0x6e,0x63,0x75,
+0x72,0x72,0x69,0x65,0x64,0x20,0x63,0x61,0x6c,0x6c,0x69,0x6e,0x67,0x0a,0x28,0x64,
+0x65,0x66,0x20,0x7b,0x63,0x75,0x72,0x72,0x79,0x7d,0x20,0x75,0x6e,0x70,0x61,0x63,
+0x6b,0x29,0x0a,0x28,0x64,0x65,0x66,0x20,0x7b,0x75,0x6e,0x63,0x75,0x72,0x72,0x79,
+0x7d,0x20,0x70,0x61,0x63,0x6b,0x29,0x0a,0x0a,0x3b,0x20,0x46,0x69,0x72,0x73,0x74,
+0x2c,0x20,0x53,0x65,0x63,0x6f,0x6e,0x64,0x2c,0x20,0x6f,0x72,0x20,0x54,0x68,0x69,
+0x72,0x64,0x20,0x49,0x74,0x65,0x6d,0x20,0x69,0x6e,0x20,0x4c,0x69,0x73,0x74,0x0a,
+0x28,0x66,0x75,0x6e,0x20,0x7b,0x66,0x73,0x74,0x20,0x6c,0x7d,0x20,0x7b,0x20,0x65,
+0x76,0x61,0x6c,0x20,0x28,0x68,0x65,0x61,0x64,0x20,0x6c,0x29,0x20,0x7d,0x29,0x0a,
+0x28,0x66,0x75,0x6e,0x20,0x7b,0x73,0x6e,0x64,0x20,0x6c,0x7d,0x20,0x7b,0x20,0x65,
+0x76,0x61,0x6c,0x20,0x28,0x68,0x65,0x61,0x64,0x20,0x28,0x74,0x61,0x69,0x6c,0x20,
+0x6c,0x29,0x29,0x20,0x7d,0x29,0x0a,0x28,0x66,0x75,0x6e,0x20,0x7b,0x74,0x72,0x64,
+0x20,0x6c,0x7d,0x20,0x7b,0x20,0x65,0x76,0x61,0x6c,0x20,0x28,0x68,0x65,0x61,0x64,
+0x20,0x28,0x74,0x61,0x69,0x6c,0x20,0x28,0x74,0x61,0x69,0x6c,0x20,0x6c,0x29,0x29,
+0x29,0x20,0x7d,0x29,0x0a,0x0a,0x3b,0x20,0x6c,0x65,0x6e,0x2c,0x20,0x6e,0x74,0x68,
+0x2c,0x20,0x6c,0x61,0x73,0x74,0x2c,0x20,0x74,0x61,0x6b,0x65,0x2c,0x20,0x64,0x72,
+0x6f,0x70,0x2c,0x20,0x65,0x6c,0x65,0x6d,0x2c,0x20,0x6d,0x61,0x70,0x2c,0x20,0x66,
+0x69,0x6c,0x74,0x65,0x72,0x2c,0x20,0x66,0x6f,0x6c,0x64,0x6c,0x2c,0x20,0x73,0x75,
+0x6d,0x20,0x61,0x6e,0x64,0x20,0x70,0x72,0x6f,0x64,0x20,0x61,0x72,0x65,0x0a,0x3b,
+0x20,0x62,0x75,0x69,0x6c,0x74,0x69,0x6e,0x2e,0x20,0x54,0x68,0x65,0x69,0x72,0x20,
+0x4c,0x69,0x73,0x70,0x20,0x64,0x65,0x66,0x69,0x6e,0x69,0x74,0x69,0x6f,0x6e,0x73,
+0x20,0x61,0x72,0x65,0x20,0x69,0x6e,0x20,0x73,0x74,0x64,0x6c,0x69,0x62,0x5f,0x6c,
+0x69,0x73,0x70,0x2e,0x6d,0x6c,0x69,0x73,0x70,0x2e,0x0a,0x0a,0x3b,0x20,0x53,0x70,
+0x6c,0x69,0x74,0x20,0x61,0x74,0x20,0x4e,0x0a,0x28,0x66,0x75,0x6e,0x20,0x7b,0x73,
+0x70,0x6c,0x69,0x74,0x20,0x6e,0x20,0x6c,0x7d,0x20,0x7b,0x6c,0x69,0x73,0x74,0x20,
+0x28,0x74,0x61,0x6b,0x65,0x20,0x6e,0x20,0x6c,0x29,0x20,0x28,0x64,0x72,0x6f,0x70,
+0x20,0x6e,0x20,0x6c,0x29,0x7d,0x29,0x0a,0x0a,0x3b,0x20,0x50,0x65,0x72,0x66,0x6f,
+0x72,0x6d,0x20,0x53,0x65,0x76,0x65,0x72,0x61,0x6c,0x20,0x74,0x68,0x69,0x6e,0x67,
+0x73,0x20,0x69,0x6e,0x20,0x53,0x65,0x71,0x75,0x65,0x6e,0x63,0x65,0x0a,0x28,0x66,
+0x75,0x6e,0x20,0x7b,0x64,0x6f,0x20,0x26,0x20,0x6c,0x7d,0x20,0x7b,0x0a,0x20,0x20,
+0x69,0x66,0x20,0x28,0x3d,0x3d,0x20,0x6c,0x20,0x6e,0x69,0x6c,0x29,0x0a,0x20,0x20,
+0x20,0x20,0x7b,0x6e,0x69,0x6c,0x7d,0x0a,0x20,0x20,0x20,0x20,0x7b,0x6c,0x61,0x73,
+0x74,0x20,0x6c,0x7d,0x0a,0x7d,0x29,0x0a,0x0a,0x3b,0x20,0x53,0x65,0x6c,0x65,0x63,
+0x74,0x0a,0x28,0x66,0x75,0x6e,0x20,0x7b,0x73,0x65,0x6c,0x65,0x63,0x74,0x20,0x26,
+0x20,0x63,0x73,0x7d,0x20,0x7b,0x0a,0x20,0x20,0x69,0x66,0x20,0x28,0x3d,0x3d,0x20,
+0x63,0x73,0x20,0x6e,0x69,0x6c,0x29,0x0a,0x20,0x20,0x20,0x20,0x7b,0x65,0x72,0x72,
+0x6f,0x72,0x20,0x22,0x4e,0x6f,0x20,0x53,0x65,0x6c,0x65,0x63,0x74,0x69,0x6f,0x6e,
+0x20,0x46,0x6f,0x75,0x6e,0x64,0x22,0x7d,0x0a,0x20,0x20,0x20,0x20,0x7b,0x69,0x66,
+0x20,0x28,0x66,0x73,0x74,0x20,0x28,0x66,0x73,0x74,0x20,0x63,0x73,0x29,0x29,0x20,
+0x7b,0x73,0x6e,0x64,0x20,0x28,0x66,0x73,0x74,0x20,0x63,0x73,0x29,0x7d,0x20,0x7b,
+0x75,0x6e,0x70,0x61,0x63,0x6b,0x20,0x73,0x65,0x6c,0x65,0x63,0x74,0x20,0x28,0x74,
+0x61,0x69,0x6c,0x20,0x63,0x73,0x29,0x7d,0x7d,0x0a,0x7d,0x29,0x0a,0x0a,0x3b,0x20,
+0x43,0x61,0x73,0x65,0x0a,0x28,0x66,0x75,0x6e,0x20,0x7b,0x63,0x61,0x73,0x65,0x20,
+0x78,0x20,0x26,0x20,0x63,0x73,0x7d,0x20,0x7b,0x0a,0x20,0x20,0x69,0x66,0x20,0x28,
+0x3d,0x3d,0x20,0x63,0x73,0x20,0x6e,0x69,0x6c,0x29,0x0a,0x20,0x20,0x20,0x20,0x7b,
+0x65,0x72,0x72,0x6f,0x72,0x20,0x22,0x4e,0x6f,0x20,0x43,0x61,0x73,0x65,0x20,0x46,
+0x6f,0x75,0x6e,0x64,0x22,0x7d,0x0a,0x20,0x20,0x20,0x20,0x7b,0x69,0x66,0x20,0x28,
+0x3d,0x3d,0x20,0x78,0x20,0x28,0x66,0x73,0x74,0x20,0x28,0x66,0x73,0x74,0x20,0x63,
+0x73,0x29,0x29,0x29,0x20,0x7b,0x73,0x6e,0x64,0x20,0x28,0x66,0x73,0x74,0x20,0x63,
+0x73,0x29,0x7d,0x20,0x7b,0x0a,0x20,0x20,0x20,0x20,0x20,0x20,0x75,0x6e,0x70,0x61,
+0x63,0x6b,0x20,0x63,0x61,0x73,0x65,0x20,0x28,0x6a,0x6f,0x69,0x6e,0x20,0x28,0x6c,
+0x69,0x73,0x74,0x20,0x78,0x29,0x20,0x28,0x74,0x61,0x69,0x6c,0x20,0x63,0x73,0x29,
+0x29,0x7d,0x7d,0x0a,0x7d,0x29,0x0a,0x0a,0x3b,0x20,0x44,0x65,0x66,0x61,0x75,0x6c,
+0x74,0x20,0x43,0x61,0x73,0x65,0x0a,0x28,0x64,0x65,0x66,0x20,0x7b,0x6f,0x74,0x68,
+0x65,0x72,0x77,0x69,0x73,0x65,0x7d,0x20,0x74,0x72,0x75,0x65,0x29,0x0a,0x0a,0x3b,
+0x20,0x4f,0x70,0x65,0x6e,0x20,0x6e,0x65,0x77,0x20,0x73,0x63,0x6f,0x70,0x65,0x0a,
+0x28,0x66,0x75,0x6e,0x20,0x7b,0x6c,0x65,0x74,0x20,0x62,0x7d,0x20,0x7b,0x0a,0x20,
+0x20,0x28,0x28,0x5c,0x20,0x7b,0x5f,0x7d,0x20,0x62,0x29,0x20,0x28,0x29,0x29,0x0a,
+0x7d,0x29,0x0a,0x0a,0x3b,0x20,0x4d,0x69,0x73,0x63,0x0a,0x28,0x66,0x75,0x6e,0x20,
+0x7b,0x66,0x6c,0x69,0x70,0x20,0x66,0x20,0x61,0x20,0x62,0x7d,0x20,0x7b,0x66,0x20,
+0x62,0x20,0x61,0x7d,0x29,0x0a,0x28,0x66,0x75,0x6e,0x20,0x7b,0x67,0x68,0x6f,0x73,
+0x74,0x20,0x26,0x20,0x78,0x73,0x7d,0x20,0x7b,0x65,0x76,0x61,0x6c,0x20,0x78,0x73,
+0x7d,0x29,0x0a,0x28,0x66,0x75,0x6e,0x20,0x7b,0x63,0x6f,0x6d,0x70,0x20,0x66,0x20,
+0x67,0x20,0x78,0x7d,0x20,0x7b,0x66,0x20,0x28,0x67,0x20,0x78,0x29,0x7d,0x29,0x0a
+};
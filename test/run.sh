@@ -0,0 +1,18 @@
+#!/bin/sh
+# Run every test with each engine, and with the stdlib defined lazily,
+# comparing what it prints with the .out file next to it
+# Usage: test/run.sh build/mlisp
+
+cd "$(dirname "$0")/.."
+status=0
+for test in test/*.mlisp; do
+  for mode in "--engine walk" "--engine vm" "--engine closure" --lazy-stdlib; do
+    if "$1" $mode "$test" 2>&1 | cmp -s - "${test%.mlisp}.out"; then
+      printf '%-28s %-18s ok\n' "$test" "$mode"
+    else
+      printf '%-28s %-18s FAILED\n' "$test" "$mode"
+      status=1
+    fi
+  done
+done
+exit $status